@@ -0,0 +1,132 @@
+// Class for a map of the directions from the source which can reach a
+// detector. Most of the gammas leave the source in directions which miss all
+// the detectors and are tracked through the world for nothing, so the primary
+// generator can use this map to skip them (see PrimaryGenerator.hh).
+//
+// The detector construction gives us the envelope of each detector (the case
+// around the crystal) as a cylinder and we divide the directions into bins,
+// linear in cos(theta) and in phi, so they all have the same solid angle. The
+// polar axis is y, which is perpendicular to the plane of the detectors, so
+// the bins near the detectors are small. A bin is reachable if any direction
+// in it can hit any envelope. To make sure of that, we test the direction of
+// the centre of the bin against the envelope enlarged by the furthest any
+// other direction of the bin can be from it over the length of the ray, so
+// the map never rejects a gamma which could hit a detector directly. The
+// gammas it rejects could only reach a detector by scattering in the air,
+// which we neglect.
+//
+// The map is built once on the master when the geometry is constructed and is
+// then only read, so all the threads share it.
+
+#ifndef __ACCEPTANCE_MAP_HH__
+#define __ACCEPTANCE_MAP_HH__
+
+#include <G4ThreeVector.hh>
+#include <G4SystemOfUnits.hh>
+
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "Cylinder.hh"
+#include "MemoryAccount.hh"
+
+//-----------------------------------------------------------------------------
+// Class for the acceptance map
+class AcceptanceMap {
+
+ private:
+   std::vector <Cylinder> cylinders;       // Envelopes of the detectors
+   unsigned int ncos;                      // Number of bins in cos(theta)
+   unsigned int nphi;                      // Number of bins in phi
+   std::vector <unsigned char> reachable;  // Is each bin reachable?
+   double fraction;                        // Fraction of the solid angle
+                                           // which is reachable
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Constructor - number of bins in cos(theta) and phi
+   AcceptanceMap(unsigned int ncos_ = 256, unsigned int nphi_ = 512) {
+      ncos = ncos_;
+      nphi = nphi_;
+      fraction = 1;
+   };
+
+   //--------------------------------------------------------------------------
+   // Add the envelope of a detector, which is a cylinder with a centre, a
+   // direction of its axis, a radius and a half length
+   void AddCylinder(const G4ThreeVector &centre, const G4ThreeVector &axis,
+                    double radius, double half) {
+      Cylinder c = {centre, axis.unit(), radius, half};
+      cylinders.push_back(c);
+   };
+
+   //--------------------------------------------------------------------------
+   // Work out which bins are reachable, once all the detectors have been
+   // added
+   void Build() {
+      reachable.assign(ncos * nphi, 0);
+      double dcos = 2. / ncos, dphi = 2. * M_PI / nphi;
+      unsigned long nreachable = 0;
+      for (unsigned int i = 0; i < ncos; i++) {
+
+         // The angle between the centre of the bin and any direction in it
+         // is at most half the range of theta plus half the range of phi
+         // along the widest circle of latitude in the bin
+         double c1 = -1. + i * dcos, c2 = c1 + dcos, cm = 0.5 * (c1 + c2);
+         double t1 = acos(c2), t2 = acos(c1), tm = acos(cm);
+         double smax = (c1 < 0 && c2 > 0) ? 1. :
+           std::max(sqrt(1. - c1 * c1), sqrt(1. - c2 * c2));
+         double delta = std::max(tm - t1, t2 - tm) + smax * 0.5 * dphi;
+         double sm = sqrt(1. - cm * cm);
+
+         for (unsigned int j = 0; j < nphi; j++) {
+            double phi = -M_PI + (j + 0.5) * dphi;
+            G4ThreeVector u(sm * cos(phi), cm, sm * sin(phi));
+            for (unsigned int k = 0; k < cylinders.size(); k++) {
+               const Cylinder &c = cylinders[k];
+               double far = c.centre.mag() + sqrt(c.radius * c.radius +
+                                                  c.half * c.half);
+               double margin = (delta < 0.5 * M_PI) ? far * sin(delta) : far;
+               if (c.Hits(G4ThreeVector(), u, margin)) {
+                  reachable[i * nphi + j] = 1;
+                  nreachable++;
+                  break;
+               }
+            }
+         }
+      }
+      fraction = (double)nreachable / (ncos * nphi);
+      MemoryAccount::Add(kMemoryAcceptance, reachable.capacity() +
+                         cylinders.capacity() * sizeof(Cylinder));
+   };
+
+   //--------------------------------------------------------------------------
+   // Can a gamma in the direction of the unit vector u reach a detector?
+   inline bool IsReachable(const G4ThreeVector &u) const {
+      int i = (int)((u.y() + 1.) * 0.5 * ncos);
+      int j = (int)((atan2(u.z(), u.x()) + M_PI) * (0.5 / M_PI) * nphi);
+      if (i >= (int)ncos) i = ncos - 1;
+      if (j >= (int)nphi) j = nphi - 1;
+      if (i < 0) i = 0;
+      if (j < 0) j = 0;
+      return(reachable[i * nphi + j]);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the fraction of the solid angle which is reachable
+   double GetFraction() const {
+      return(fraction);
+   };
+
+   //--------------------------------------------------------------------------
+   // Show the map
+   void Show() const {
+      printf("Acceptance map: %u detectors, %u x %u bins, %.2f %% of the solid angle reachable\n",
+             (unsigned int)cylinders.size(), ncos, nphi, fraction * 100.);
+   };
+};
+
+#endif
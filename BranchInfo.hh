@@ -0,0 +1,34 @@
+// Class to tag a track with the branch of the event it belongs to. When a
+// gamma is split (see SplittingOperator.hh), each copy starts a branch of the
+// event and everything it produces belongs to that branch (see
+// TrackingAction.hh). Tracks without a tag belong to all the branches, as
+// they happened before the split or independently of it.
+
+#ifndef __BRANCH_INFO_HH__
+#define __BRANCH_INFO_HH__
+
+#include <G4VUserTrackInformation.hh>
+
+//-----------------------------------------------------------------------------
+// Class for the branch of a track
+class BranchInfo : public G4VUserTrackInformation {
+
+ private:
+   unsigned int branch; // Branch of the event (1 to the splitting factor)
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Constructor
+   BranchInfo(unsigned int branch_) {
+      branch = branch_;
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the branch
+   inline unsigned int GetBranch() const {
+      return(branch);
+   };
+};
+
+#endif
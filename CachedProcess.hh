@@ -0,0 +1,176 @@
+// Class to cache the mean free paths of a gamma process at the energies of
+// the transitions of the level scheme. Almost all the steps we track are
+// gammas of those few energies which haven't interacted yet, in the few
+// materials of the geometry, so each thread keeps a table of the mean free
+// path for each material (couple) and each energy and only asks the process
+// for the others.
+//
+// This is a thin wrapper (G4WrapperProcess) around one of the EM processes of
+// the gamma (see PhysicsList.hh), which forwards everything else to it,
+// including building its tables. We do the bookkeeping of the number of
+// interaction lengths left ourselves, just as a G4VDiscreteProcess does, so
+// the process itself isn't asked for its interaction length on every step.
+// When we do interact, we let the process define its material and energy for
+// the step before it does the interaction, so the models are selected by the
+// process just as before. The physics is the same, but the random numbers are
+// used differently.
+//
+// Each instance counts the cache hits (one of our energies and already in the
+// table), misses (one of our energies, but not yet in the table) and the
+// lookups at other energies, which always go to the process. Show() gives the
+// sums over all the threads for each process, so we can see whether the cache
+// pays off for a given level scheme.
+
+#ifndef __CACHED_PROCESS_HH__
+#define __CACHED_PROCESS_HH__
+
+#include <G4WrapperProcess.hh>
+#include <G4VEmProcess.hh>
+#include <G4ProductionCutsTable.hh>
+#include <G4MaterialCutsCouple.hh>
+#include <G4Track.hh>
+#include <G4Step.hh>
+#include <G4AutoLock.hh>
+#include <G4Log.hh>
+#include <Randomize.hh>
+
+#include <cstdio>
+#include <cfloat>
+#include <vector>
+#include <algorithm>
+
+//-----------------------------------------------------------------------------
+// Class for a gamma process with a cache of mean free paths
+class CachedProcess : public G4WrapperProcess {
+
+ private:
+   G4VEmProcess *process;           // The process we wrap
+   std::vector <double> energies;   // Energies we cache (sorted)
+   std::vector <double> mfp;        // Mean free path for each couple and
+                                    // energy (< 0 = not yet known)
+   unsigned long long nhits;        // Lookups found in the cache
+   unsigned long long nmisses;      // Lookups at our energies not yet cached
+   unsigned long long nother;       // Lookups at other energies
+
+   static std::vector <CachedProcess *> instances; // All the instances
+   static G4Mutex mutex;            // Lock for the list of instances
+
+   //--------------------------------------------------------------------------
+   // Get the mean free path of a track, from the cache if we can
+   double MeanFreePath(const G4Track &track) {
+
+      // Is it one of our energies?
+      double E = track.GetKineticEnergy();
+      std::vector <double>::const_iterator it =
+        std::lower_bound(energies.begin(), energies.end(), E);
+      if (it == energies.end() || *it != E) {
+         nother++;
+         return(process->MeanFreePath(track));
+      }
+
+      // Look up the couple and energy, filling the cache if necessary
+      size_t couple = track.GetMaterialCutsCouple()->GetIndex();
+      size_t index = couple * energies.size() + (it - energies.begin());
+      if (index >= mfp.size()) {
+         size_t ncouples = G4ProductionCutsTable::GetProductionCutsTable()->
+           GetTableSize();
+         if (couple >= ncouples) ncouples = couple + 1;
+         mfp.resize(ncouples * energies.size(), -1.);
+      }
+      if (mfp[index] >= 0) {
+         nhits++;
+         return(mfp[index]);
+      }
+      nmisses++;
+      mfp[index] = process->MeanFreePath(track);
+      return(mfp[index]);
+   };
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Constructor - the process to wrap and the energies to cache
+   CachedProcess(G4VEmProcess *process_, const std::vector <double> &energies_) :
+     G4WrapperProcess(process_->GetProcessName(), process_->GetProcessType()) {
+      process = process_;
+      RegisterProcess(process);
+      SetProcessSubType(process->GetProcessSubType());
+      energies = energies_;
+      std::sort(energies.begin(), energies.end());
+      nhits = nmisses = nother = 0;
+      G4AutoLock l(&mutex);
+      instances.push_back(this);
+   };
+
+   //--------------------------------------------------------------------------
+   // Destructor
+   ~CachedProcess() {
+      G4AutoLock l(&mutex);
+      std::vector <CachedProcess *>::iterator it =
+        std::find(instances.begin(), instances.end(), this);
+      if (it != instances.end()) instances.erase(it);
+   };
+
+   //--------------------------------------------------------------------------
+   // Start of a track - forget the interaction lengths left
+   void StartTracking(G4Track *track) {
+      G4WrapperProcess::StartTracking(track);
+      theNumberOfInteractionLengthLeft = -1.;
+      currentInteractionLength = -1.;
+   };
+
+   //--------------------------------------------------------------------------
+   // Interaction length of this step, as in G4VDiscreteProcess, but with the
+   // mean free path from the cache
+   G4double PostStepGetPhysicalInteractionLength(const G4Track &track,
+                                                 G4double previousStepSize,
+                                                 G4ForceCondition *condition) {
+      if (previousStepSize < 0 || theNumberOfInteractionLengthLeft <= 0) {
+         theNumberOfInteractionLengthLeft = -G4Log(G4UniformRand());
+         theInitialNumberOfInteractionLength = theNumberOfInteractionLengthLeft;
+      } else if (previousStepSize > 0)
+        SubtractNumberOfInteractionLengthLeft(previousStepSize);
+      *condition = NotForced;
+      currentInteractionLength = MeanFreePath(track);
+      if (currentInteractionLength >= DBL_MAX) return(DBL_MAX);
+      return(theNumberOfInteractionLengthLeft * currentInteractionLength);
+   };
+
+   //--------------------------------------------------------------------------
+   // Do the interaction - let the process define the material and energy of
+   // the step and then do it
+   G4VParticleChange *PostStepDoIt(const G4Track &track, const G4Step &step) {
+      G4ForceCondition condition;
+      process->PostStepGetPhysicalInteractionLength(track, -1., &condition);
+      theNumberOfInteractionLengthLeft = -1.;
+      return(process->PostStepDoIt(track, step));
+   };
+
+   //--------------------------------------------------------------------------
+   // Show the hits and misses of each process, summed over all the threads
+   static void Show() {
+      G4AutoLock l(&mutex);
+      std::vector <G4String> names;
+      for (unsigned int i = 0; i < instances.size(); i++)
+        if (std::find(names.begin(), names.end(),
+                      instances[i]->GetProcessName()) == names.end())
+          names.push_back(instances[i]->GetProcessName());
+      for (unsigned int j = 0; j < names.size(); j++) {
+         unsigned long long hits = 0, misses = 0, other = 0;
+         for (unsigned int i = 0; i < instances.size(); i++) {
+            if (instances[i]->GetProcessName() != names[j]) continue;
+            hits += instances[i]->nhits;
+            misses += instances[i]->nmisses;
+            other += instances[i]->nother;
+         }
+         unsigned long long total = hits + misses + other;
+         printf("Cross-section cache %-8s %12llu lookups %12llu hits %8llu misses %12llu other energies (hit rate %.2f %%)\n",
+                names[j].c_str(), total, hits, misses, other,
+                total ? 100. * hits / total : 0.);
+      }
+   };
+};
+std::vector <CachedProcess *> CachedProcess::instances;
+G4Mutex CachedProcess::mutex = G4MUTEX_INITIALIZER;
+
+#endif
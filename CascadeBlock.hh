@@ -0,0 +1,289 @@
+// Class to hold a block of pre-generated cascades. Rather than drawing a few
+// random numbers at a time for each gamma and setting up the particle gun
+// every time, we generate a whole block of cascades in one go. The random
+// numbers are drawn in bulk from the engine, the walk through the level
+// scheme only picks the transitions and the times and directions are then
+// computed for all the gammas in the block with simple loops over contiguous
+// arrays, which the compiler can vectorise, as the log, sine and cosine come
+// from VectorMath.hh rather than the C library. The primary generator then
+// only has to pop the next cascade from the block.
+//
+// The time of each gamma is relative to the start of the event, which is the
+// time of the first gamma, just as before, so we keep picosecond precision.
+//
+// For stratified sampling (see LevelScheme::Stratify), we don't walk through
+// the level scheme, but take the cascades from its list of paths. A block has
+// the minimum number of each path and the rest are drawn with the true
+// probabilities, then the block is shuffled, so the paths come in a random
+// order. A block of a different size (e.g. one cascade per event with
+// per-event streams) can't hold the minimum, so its cascades are drawn with
+// the probabilities the paths would have in a full block. Either way, each
+// cascade has the weight of its path.
+
+#ifndef __CASCADE_BLOCK_HH__
+#define __CASCADE_BLOCK_HH__
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <Randomize.hh>
+
+#include "LevelScheme.hh"
+#include "EventContext.hh"
+#include "MemoryAccount.hh"
+#include "VectorMath.hh"
+
+//-----------------------------------------------------------------------------
+// Number of cascades in a full block, which is also the block over which
+// stratified sampling has the minimum of each path
+static const unsigned int kCascadeBlockSize = 4096;
+
+//-----------------------------------------------------------------------------
+// Class for a block of cascades
+class CascadeBlock {
+
+ private:
+   unsigned int capacity;          // Number of cascades per block
+   unsigned int next;              // Index of next cascade to pop
+   std::vector <unsigned int> first;   // Index of first gamma of each cascade
+   std::vector <unsigned int> ngamma;  // Number of gammas of each cascade
+   std::vector <double> energy;        // Energy of each gamma
+   std::vector <double> tau;           // Tau of level populated by each gamma
+   std::vector <unsigned int> line;    // Index of transition of each gamma
+   std::vector <double> time;          // Emission time of each gamma
+   std::vector <double> dx, dy, dz;    // Direction of each gamma
+   std::vector <double> weight;        // Weight of each cascade (empty if
+                                       // not stratified)
+   std::vector <unsigned int> chosen;  // Path of each cascade (stratified)
+   std::vector <double> random;        // Bulk random numbers
+   unsigned int nrandom;               // Number of random numbers available
+   unsigned int irandom;               // Index of next random number
+   long reported;                      // Bytes reported to the accounting
+
+   //--------------------------------------------------------------------------
+   // Fill the vector of random numbers with n flat random numbers from the
+   // engine of this thread (kept in its event context)
+   void FillRandom(unsigned int n) {
+      if (random.size() < n) random.resize(n);
+      EventContext::Get()->GetEngine()->flatArray(n, random.data());
+      nrandom = n;
+      irandom = 0;
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the next of the bulk random numbers, refilling them if necessary
+   inline double NextRandom() {
+      if (irandom >= nrandom) FillRandom(capacity);
+      return(random[irandom++]);
+   };
+
+   //--------------------------------------------------------------------------
+   // Walk through the level scheme for each cascade, which is the same as the
+   // old per-event loop, but just records the energies and the tau of the
+   // level populated by each gamma
+   void Walk(const LevelScheme &ls) {
+
+      energy.clear();
+      tau.clear();
+      line.clear();
+      FillRandom(capacity);
+      for (unsigned int i = 0; i < capacity; i++) {
+         first[i] = energy.size();
+
+         // Pick an initial level at random weighted by the population
+         Level *level = ls.PickPrimaryLevel(NextRandom());
+         while (level) {
+
+            // Negative tau means stable
+            if (level->GetTau() < 0) break;
+
+            // Pick a depopulating transition
+            Transition *transition =
+              level->PickDepopulatingTransition(NextRandom());
+            if (!transition) break; // NULL means no depopulating transition
+
+            // Record the gamma, the tau of the level it populates and the
+            // transition
+            level = transition->GetFinal();
+            energy.push_back(transition->GetEnergy());
+            tau.push_back(level->GetTau());
+            line.push_back(transition->GetIndex());
+         }
+         ngamma[i] = energy.size() - first[i];
+      }
+      weight.clear();
+   };
+
+   //--------------------------------------------------------------------------
+   // Take the cascades from the paths of the level scheme for stratified
+   // sampling, with their weights
+   void WalkPaths(const LevelScheme &ls) {
+
+      // Choose the path of each cascade: the minimum of each path and the
+      // rest with the true probabilities in a full block, otherwise all with
+      // the sampled probabilities
+      const std::vector <CascadePath> &paths = ls.GetPaths();
+      unsigned int k = 0;
+      chosen.resize(capacity);
+      FillRandom(capacity);
+      bool full = (capacity == ls.GetBlockSize());
+      if (full)
+        for (unsigned int i = 0; i < paths.size(); i++)
+          for (unsigned int j = 0; j < ls.GetMinimum(); j++)
+            chosen[k++] = i;
+      for (; k < capacity; k++) chosen[k] = ls.PickPath(NextRandom(), !full);
+
+      // Shuffle them (Fisher-Yates)
+      for (unsigned int i = capacity - 1; i > 0; i--) {
+         unsigned int j = (unsigned int)(NextRandom() * (i + 1));
+         if (j > i) j = i;
+         std::swap(chosen[i], chosen[j]);
+      }
+
+      // Copy the gammas of each path
+      energy.clear();
+      tau.clear();
+      line.clear();
+      weight.resize(capacity);
+      for (unsigned int i = 0; i < capacity; i++) {
+         const CascadePath &path = paths[chosen[i]];
+         first[i] = energy.size();
+         ngamma[i] = path.energy.size();
+         energy.insert(energy.end(), path.energy.begin(), path.energy.end());
+         tau.insert(tau.end(), path.tau.begin(), path.tau.end());
+         line.insert(line.end(), path.line.begin(), path.line.end());
+         weight[i] = path.weight;
+      }
+   };
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Constructor
+   CascadeBlock(unsigned int capacity_ = kCascadeBlockSize) {
+      capacity = capacity_;
+      next = capacity;
+      nrandom = irandom = 0;
+      reported = 0;
+      first.resize(capacity);
+      ngamma.resize(capacity);
+   };
+
+   //--------------------------------------------------------------------------
+   // Is the block used up?
+   bool IsEmpty() {
+      return(next >= capacity);
+   };
+
+   //--------------------------------------------------------------------------
+   // Fill the block with new cascades from the level scheme
+   void Fill(const LevelScheme &ls) {
+
+      // Pick the transitions for each cascade
+      if (ls.GetMinimum() > 0) WalkPaths(ls);
+      else Walk(ls);
+      unsigned int n = energy.size();
+      time.resize(n);
+      dx.resize(n);
+      dy.resize(n);
+      dz.resize(n);
+
+      // Three random numbers per gamma: one for the time and two for the
+      // direction
+      FillRandom(3 * n);
+      const double *ut = random.data();
+      const double *uc = random.data() + n;
+      const double *up = random.data() + 2 * n;
+
+      // Delay after each gamma - exponential with the tau of the level it
+      // populates or zero if that level is stable. We use 1 - u so that the
+      // argument of the log is never zero. The log is taken for every gamma
+      // and multiplied by a tau of zero for a stable level, so the loop has
+      // no branch.
+      double *t = time.data();
+      const double *ta = tau.data();
+#pragma omp simd
+      for (unsigned int i = 0; i < n; i++) {
+         double mean = (ta[i] > 0) ? ta[i] : 0.;
+         t[i] = -mean * VectorMath::Log(1. - ut[i]);
+      }
+
+      // Isotropic directions, linear in cos(theta) and linear in phi, using
+      // sin(theta) = sqrt((1 - cos(theta)) * (1 + cos(theta))) so we don't
+      // need acos or a rejection loop
+      double *x = dx.data(), *y = dy.data(), *z = dz.data();
+#pragma omp simd
+      for (unsigned int i = 0; i < n; i++) {
+         double cosTheta = 2. * uc[i] - 1.;
+         double sinTheta = std::sqrt((1. - cosTheta) * (1. + cosTheta));
+         double sinPhi, cosPhi;
+         VectorMath::SinCos2Pi(up[i], sinPhi, cosPhi);
+         x[i] = sinTheta * cosPhi;
+         y[i] = sinTheta * sinPhi;
+         z[i] = cosTheta;
+      }
+
+      // Turn the delays into emission times relative to the first gamma of
+      // each cascade (a short running sum per cascade)
+      for (unsigned int i = 0; i < capacity; i++) {
+         double sum = 0;
+         for (unsigned int j = first[i]; j < first[i] + ngamma[i]; j++) {
+            double delay = t[j];
+            t[j] = sum;
+            sum += delay;
+         }
+      }
+      next = 0;
+
+      // Account for the memory of the buffers, which only grow
+      MemoryAccount::Update(kMemoryCascades, reported,
+                            (first.capacity() + ngamma.capacity() +
+                             chosen.capacity() + line.capacity()) *
+                            sizeof(unsigned int) +
+                            (energy.capacity() + tau.capacity() +
+                             time.capacity() + dx.capacity() + dy.capacity() +
+                             dz.capacity() + weight.capacity() +
+                             random.capacity()) *
+                            sizeof(double));
+   };
+
+   //--------------------------------------------------------------------------
+   // Pop the next cascade. Returns the number of gammas and the index of the
+   // first one for use with the Get methods below.
+   unsigned int Pop(unsigned int &index) {
+      index = first[next];
+      return(ngamma[next++]);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the weight of the cascade we popped last (1 if not stratified)
+   inline double GetWeight() {
+      return(weight.empty() ? 1. : weight[next - 1]);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the energy of the ith gamma
+   inline double GetEnergy(unsigned int i) {
+      return(energy[i]);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the index of the transition of the ith gamma in the level scheme
+   inline unsigned int GetLine(unsigned int i) {
+      return(line[i]);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the emission time of the ith gamma
+   inline double GetTime(unsigned int i) {
+      return(time[i]);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the direction of the ith gamma
+   inline G4ThreeVector GetDirection(unsigned int i) {
+      return(G4ThreeVector(dx[i], dy[i], dz[i]));
+   };
+};
+
+#endif
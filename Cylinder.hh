@@ -0,0 +1,57 @@
+// A cylinder, which is how we describe a crystal or the case around it when
+// we need to know quickly whether a gamma is heading for it: the acceptance
+// map (see AcceptanceMap.hh) for the gammas from the source and the splitting
+// (see SplittingOperator.hh) for the gammas leaving a detector.
+
+#ifndef __CYLINDER_HH__
+#define __CYLINDER_HH__
+
+#include <G4ThreeVector.hh>
+#include <G4SystemOfUnits.hh>
+
+#include <cmath>
+#include <algorithm>
+
+//-----------------------------------------------------------------------------
+// A cylinder with a centre, a direction of its axis, a radius and a half
+// length
+struct Cylinder {
+   G4ThreeVector centre;  // Centre
+   G4ThreeVector axis;    // Unit vector along the axis
+   double radius;         // Radius
+   double half;           // Half length
+
+   //--------------------------------------------------------------------------
+   // Does the ray from the point p in direction u hit the cylinder enlarged
+   // by margin in radius and length? Only the part of the ray more than a
+   // micron from p counts, so a ray leaving the surface doesn't hit it.
+   bool Hits(const G4ThreeVector &p, const G4ThreeVector &u,
+             double margin = 0) const {
+      double r = radius + margin, h = half + margin;
+      G4ThreeVector c = centre - p;
+
+      // Along the axis, the ray is within the length for s in [lo, hi]
+      double ua = u.dot(axis), ca = c.dot(axis);
+      double lo = 1e-3 * mm, hi = 1e30;
+      if (fabs(ua) > 1e-12) {
+         double s1 = (ca - h) / ua, s2 = (ca + h) / ua;
+         if (s1 > s2) std::swap(s1, s2);
+         if (s1 > lo) lo = s1;
+         if (s2 < hi) hi = s2;
+      } else if (fabs(ca) > h) return(false);
+      if (lo > hi) return(false);
+
+      // Across the axis, the squared distance from the axis less r^2 is
+      // a s^2 - 2 b s + d, which must not be positive
+      double a = 1. - ua * ua;
+      double b = u.dot(c) - ua * ca;
+      double d = c.mag2() - ca * ca - r * r;
+      if (a < 1e-12) return(d <= 0);
+      double disc = b * b - a * d;
+      if (disc < 0) return(false);
+      double s1 = (b - sqrt(disc)) / a, s2 = (b + sqrt(disc)) / a;
+      return(s1 <= hi && s2 >= lo);
+   };
+};
+
+#endif
@@ -1,21 +1,33 @@
 // Class to define a set of values, which are represented by an array
-// internally, so they can easily be used in root. We will need one instance
-// of this class per thread (including the master thread). It handles a certain
-// number of values for each detector, with a certain number of detectors.
-// Both of these numbers can be set by the calling code.
+// internally, so they can easily be used in root. We need one instance of this
+// class per thread, which lives in the EventContext of that thread. It handles
+// a certain number of values for each detector, with a certain number of
+// detectors. Both of these numbers can be set by the calling code. The values are
+// allocated in whole cache lines, so that the data of different threads never
+// share a cache line. The layout of the record (see RecordLayout.hh) gives
+// the operations compiled for the number of detectors, which the sensitive
+// detectors use to store their values at fixed offsets without bounds
+// checks. If we tag the deposits (see RecordLayout.hh), there is also a tag
+// for each detector.
 
 #ifndef __DATUM_HH__
 #define __DATUM_HH__
 
 #include <cstring>
+#include <cstdlib>
+#include <stdint.h>
+
+#include "RecordLayout.hh"
 
 class Datum {
 
  private:
    double *values;
+   uint16_t *tags;
    unsigned int nperdet;
    unsigned int ndet;
    bool has_data;
+   RecordLayout layout;
    
  public:
 
@@ -23,6 +35,7 @@ class Datum {
    // Constructor
    Datum(unsigned int ndet_ = 0, unsigned int nperdet_ = 0) {
       values = NULL;
+      tags = NULL;
       nperdet = 0;
       ndet = 0;
       has_data = false;
@@ -32,24 +45,34 @@ class Datum {
    //--------------------------------------------------------------------------
    // Destructor
    ~Datum() {
-      if (values) delete [] values;
+      if (values) free(values);
+      if (tags) delete [] tags;
    };
 
    //--------------------------------------------------------------------------
-   // Set the number of values
-   void SetDimensions(unsigned int ndet_, unsigned int nperdet_) {
+   // Set the number of values (2 or 5 per detector) and whether we have
+   // the tags
+   void SetDimensions(unsigned int ndet_, unsigned int nperdet_,
+                      bool tagged = false) {
 
-      // If we have already allocated an array, delete it
-      if (values) delete [] values;
+      // If we have already allocated the arrays, delete them
+      if (values) free(values);
       values = NULL;
+      if (tags) delete [] tags;
+      tags = NULL;
 
       // Store the parameters
       nperdet = nperdet_;
       ndet = ndet_;
+      layout = RecordLayout(ndet, nperdet > 4);
 
       // If we have values, reserve memory and reset
       if (ndet_ * nperdet_ < 1) return;
-      values = new double[ndet_ * nperdet_];
+      if (tagged) tags = new uint16_t[ndet_];
+      size_t size = sizeof(double) * ndet_ * nperdet_;
+      void *p = NULL;
+      if (posix_memalign(&p, 64, (size + 63) / 64 * 64)) return;
+      values = (double *)p;
       Reset();
    };
    
@@ -59,6 +82,12 @@ class Datum {
       return(values);
    };
 
+   //--------------------------------------------------------------------------
+   // Get pointer to the tags (NULL if we don't have them)
+   uint16_t *GetTags() {
+      return(tags);
+   };
+
    //--------------------------------------------------------------------------
    // Get number of data values per detector
    unsigned int GetNPerDetector() {
@@ -74,7 +103,8 @@ class Datum {
    //--------------------------------------------------------------------------
    // Reset
    void Reset() {
-      memset(values, 0, sizeof(double) * (nperdet * ndet));
+      if (values) layout.Reset(values);
+      if (tags) memset(tags, 0, sizeof(uint16_t) * ndet);
       has_data = false;
    };
    
@@ -91,6 +121,9 @@ class Datum {
         ndet * nperdet : rhs.ndet * rhs.nperdet;
 
       memcpy(values, rhs.values, sizeof(double) * maxvalues);
+      if (tags && rhs.tags)
+        memcpy(tags, rhs.tags, sizeof(uint16_t) *
+               ((ndet < rhs.ndet) ? ndet : rhs.ndet));
       return(*this);
    };
    
@@ -103,6 +136,28 @@ class Datum {
       has_data = true;
    };
    
+   //--------------------------------------------------------------------------
+   // Store the energy, time and position of the nth detector, which must
+   // exist
+   inline void Store(unsigned int n, double E, double T, double x, double y,
+                     double z) {
+      layout.Store(values, n, E, T, x, y, z);
+      has_data = true;
+   };
+
+   //--------------------------------------------------------------------------
+   // Set the tag of the nth detector, which must exist, if we have the tags
+   inline void SetTag(unsigned int n, uint16_t tag) {
+      if (tags) tags[n] = tag;
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the tag of the nth detector (0 if we don't have the tags)
+   uint16_t GetTag(unsigned int n) {
+      if (!tags || n >= ndet) return(0);
+      return(tags[n]);
+   };
+
    //--------------------------------------------------------------------------
    // Get photocathode energy
    double GetValue(unsigned int n, unsigned int v) {
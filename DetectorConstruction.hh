@@ -17,23 +17,37 @@
 #include <vector>
 
 #include "SensitiveDetector.hh"
+#include "EventContext.hh"
+#include "TimePickoff.hh"
+#include "AcceptanceMap.hh"
+#include "Cylinder.hh"
+#include "SplittingOperator.hh"
 
 //-----------------------------------------------------------------------------
 // This class generates a set of cylindrical detectors in a horizontal plane
 // around the origin with a distance of 40 mm from the origin. The constructor
 // is initialised with the number of detectors and they are spaced equally. The
 // detectors are simple cylinders. For each detector a sensitive detector is
-// created and for each event, the energy and time will be pu into an array,
-// which is passed to the constructor (one element per detector) so that
-// listmode can be constructed.
+// created and for each event, the energy and time will be put into the Datum
+// of the event context of the thread (one element per detector) so that
+// listmode can be constructed. With a time pickoff, the sensitive detectors
+// of all the threads share it to work out the times. If we are given an
+// acceptance map, we add the case of each detector to it and build it, so the
+// primary generator can skip the gammas which can't reach any detector. If
+// we are given a splitting factor, each thread attaches an operator to the
+// crystals and cases to split the gammas which scatter towards a crystal and
+// play roulette with the others (see SplittingOperator.hh).
 class DetectorConstruction : public G4VUserDetectorConstruction {
 
  private:
    G4NistManager *man; // NIST material manager
    G4LogicalVolume *log_world; // World logical volume
    std::vector <G4LogicalVolume *> log_sci, log_case; // Other logical volumes
-   Datum *data; // Data storage (one Datum per thread, including master thread)
    int ndet;    // Number of detectors
+   const TimePickoff *pickoff; // Time pickoff (NULL for none)
+   AcceptanceMap *acceptance;  // Acceptance map to build (NULL for none)
+   unsigned int split;         // Splitting factor (0 for none)
+   std::vector <Cylinder> crystals, cases; // Crystals and cases as cylinders
 
    //--------------------------------------------------------------------------
    // Set up the materials we need using the NIST database
@@ -67,11 +81,15 @@ class DetectorConstruction : public G4VUserDetectorConstruction {
 
    //--------------------------------------------------------------------------
    // Constructor
-   DetectorConstruction(Datum *data_, int ndet_) {
+   DetectorConstruction(int ndet_, const TimePickoff *pickoff_ = NULL,
+                        AcceptanceMap *acceptance_ = NULL,
+                        unsigned int split_ = 0) {
       // Get or construct materials
       GetMaterials();
-      data = data_;
       ndet = ndet_;
+      pickoff = pickoff_;
+      acceptance = acceptance_;
+      split = split_;
    };
 
    //--------------------------------------------------------------------------
@@ -158,6 +176,21 @@ class DetectorConstruction : public G4VUserDetectorConstruction {
          sprintf(name, "case_%d", i);
          new G4PVPlacement(G4Transform3D(rot, pos),
                            log_case[i], name, log_world, false, 0, false);
+
+         // Keep the crystal and the case as cylinders for the splitting
+         Cylinder crystal = {pos, rot * G4ThreeVector(0, 0, 1), r, l/2};
+         Cylinder envelope = {pos, crystal.axis, r + gap + t, l/2 + gap + t};
+         crystals.push_back(crystal);
+         cases.push_back(envelope);
+
+         // The case is the envelope of the detector for the acceptance map
+         if (acceptance)
+           acceptance->AddCylinder(pos, crystal.axis, r + gap + t,
+                                   l/2 + gap + t);
+      }
+      if (acceptance) {
+         acceptance->Build();
+         acceptance->Show();
       }
       return(phys_world);
    };
@@ -166,11 +199,10 @@ class DetectorConstruction : public G4VUserDetectorConstruction {
    // Construct sensitive detector
    void ConstructSDandField() {
 
-      double offset[] = {200, 300, 50, 150, 330, 180, 250, 190};
       char name[1024];
       
-      // Get thread ID
-      int thread = (G4Threading::G4GetThreadId() + 1);
+      // Get the event context of this thread
+      EventContext *context = EventContext::Get();
 
       // Create an sensitive detector manager
       G4SDManager *sd_manager = G4SDManager::GetSDMpointer();
@@ -179,13 +211,23 @@ class DetectorConstruction : public G4VUserDetectorConstruction {
       for (int i = 0; i < ndet; i++) {
          sprintf(name, "LaBr3_%d", i);
          SensitiveDetector *sensitive = new SensitiveDetector(name);
-         sensitive->SetSigmaCoefficients(5., 5e-3); // sigma = 5 + E * 0.005
-         sensitive->SetTimeOffset(offset[i]);
-         sensitive->SetDataPointer(data + thread);
          sensitive->SetID(i);
+         sensitive->SetContext(context);
+         if (pickoff) sensitive->SetPickoff(pickoff);
          sd_manager->AddNewDetector(sensitive);
          log_sci[i]->SetSensitiveDetector(sensitive);
       }
+
+      // Attach the splitting operator of this thread to the crystals and
+      // cases
+      if (split) {
+         SplittingOperator *splitting =
+           new SplittingOperator(split, &crystals, &cases);
+         for (int i = 0; i < ndet; i++) {
+            splitting->AttachTo(log_sci[i]);
+            splitting->AttachTo(log_case[i]);
+         }
+      }
    };   
 };
 
@@ -0,0 +1,197 @@
+// Class to apply the detector response to the true deposits stored by the
+// simulation. The simulation only stores the energy deposited and the average
+// time of the interactions, so that one simulation can be used for many
+// different resolutions. The response (energy resolution, time resolution,
+// time walk, time offsets and threshold) is read from a text file and can be
+// applied to the data either as it is written (see RootOutput.hh) or in the
+// analysis (see analyse.cc), which is much cheaper than running the tracking
+// again.
+//
+// The file has one setting per line. DET is a detector number or "all".
+// Energies are in keV and times in ps:
+//
+// energy    DET A B   - energy resolution sigma(E) = A + B * E
+// time      DET A B   - time resolution sigma(T) = A + B / sqrt(E)
+// walk      DET A B   - time walk T += A + B / sqrt(E)
+// offset    DET T     - time offset T += T
+// threshold DET E     - detector doesn't fire if the smeared E < threshold
+// seed      N         - seed for the random numbers
+//
+// The random numbers come from a counter-based engine, with the stream
+// selected by the entry number of each event, so the result doesn't depend on
+// the number of threads, on the order in which the entries are processed or
+// on whether they are processed in blocks (the output) or one at a time (the
+// analysis). The Gaussian random numbers are made in bulk for all the
+// detectors of a block of events with the Box-Muller method in a loop which
+// the compiler can vectorise (see VectorMath.hh).
+
+#ifndef __DETECTOR_RESPONSE_HH__
+#define __DETECTOR_RESPONSE_HH__
+
+#include <TString.h>
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <stdint.h>
+
+#include "PhiloxEngine.hh"
+#include "VectorMath.hh"
+
+//-----------------------------------------------------------------------------
+// Class for the detector response
+class DetectorResponse {
+
+ private:
+   unsigned int ndet;                 // Number of detectors
+   unsigned int nperdet;              // Number of values per detector
+   std::vector <double> e0, e1;       // Energy resolution coefficients
+   std::vector <double> t0, t1;       // Time resolution coefficients
+   std::vector <double> w0, w1;       // Time walk coefficients
+   std::vector <double> offset;       // Time offsets
+   std::vector <double> threshold;    // Energy thresholds
+   long seed;                         // Seed for random numbers
+   PhiloxEngine engine;               // Random number engine
+   std::vector <double> u;            // Flat random numbers
+   std::vector <double> gE, gT;       // Gaussian random numbers
+
+   //--------------------------------------------------------------------------
+   // Set a coefficient for one detector or for all (det < 0)
+   void Set(std::vector <double> &v, int det, double value) {
+      if (det >= (int)ndet) return;
+      if (det >= 0) v[det] = value;
+      else for (unsigned int i = 0; i < ndet; i++) v[i] = value;
+   };
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Constructor - no resolution, walk, offset or threshold
+   DetectorResponse(unsigned int ndet_, unsigned int nperdet_) {
+      ndet = ndet_;
+      nperdet = nperdet_;
+      e0.assign(ndet, 0);
+      e1.assign(ndet, 0);
+      t0.assign(ndet, 0);
+      t1.assign(ndet, 0);
+      w0.assign(ndet, 0);
+      w1.assign(ndet, 0);
+      offset.assign(ndet, 0);
+      threshold.assign(ndet, 0);
+      seed = 1;
+   };
+
+   //--------------------------------------------------------------------------
+   // Read the response from a file. Returns false if we can't read it.
+   bool Read(const char *filename) {
+
+      // Open the file
+      FILE *fp = fopen(filename, "r");
+      if (!fp) {
+         fprintf(stderr, "Unable to read file %s\n", filename);
+         return(false);
+      }
+
+      // Parse it
+      TString st;
+      while(st.Gets(fp)) {
+         char key[32], detector[32];
+         double a = 0, b = 0;
+         long n;
+
+         // Seed
+         if (sscanf(st.Data(), "seed %ld", &n) == 1) {
+            seed = n;
+            continue;
+         }
+
+         // Settings for detectors
+         int status = sscanf(st.Data(), "%31s %31s %lf %lf", key, detector,
+                             &a, &b);
+         if (status < 3 || key[0] == '#') continue;
+         int det = strcmp(detector, "all") ? atoi(detector) : -1;
+         if (!strcmp(key, "energy")) {
+            Set(e0, det, a);
+            Set(e1, det, b);
+         } else if (!strcmp(key, "time")) {
+            Set(t0, det, a);
+            Set(t1, det, b);
+         } else if (!strcmp(key, "walk")) {
+            Set(w0, det, a);
+            Set(w1, det, b);
+         } else if (!strcmp(key, "offset"))
+           Set(offset, det, a);
+         else if (!strcmp(key, "threshold"))
+           Set(threshold, det, a);
+      }
+
+      // Close the file
+      fclose(fp);
+      return(true);
+   };
+
+   //--------------------------------------------------------------------------
+   // Show the response
+   void Show() {
+      printf("Detector response (seed %ld):\n", seed);
+      for (unsigned int i = 0; i < ndet; i++)
+        printf("\t%2u: sigma(E) = %g + %g E  sigma(T) = %g + %g/sqrt(E)  walk = %g + %g/sqrt(E)  offset = %g ps  threshold = %g keV\n",
+               i, e0[i], e1[i], t0[i], t1[i], w0[i], w1[i], offset[i],
+               threshold[i]);
+   };
+
+   //--------------------------------------------------------------------------
+   // Apply the response to a block of nevents events, which start with the
+   // given entry number, in place. Item 0 of each detector is the energy and
+   // item 1 is the time. Detectors which didn't fire are left alone.
+   void Apply(double *values, unsigned int nevents, uint64_t entry) {
+
+      // Flat random numbers - four per detector per event, from the stream
+      // of the entry of each event
+      unsigned int n = nevents * ndet;
+      if (u.size() < 4 * n) {
+         u.resize(4 * n);
+         gE.resize(n);
+         gT.resize(n);
+      }
+      for (unsigned int k = 0; k < nevents; k++) {
+         uint64_t e = entry + k;
+         engine.SetStream((uint64_t)seed, (uint32_t)(e >> 32), (uint32_t)e);
+         for (unsigned int j = 0; j < 4; j++)
+           engine.flatArray(ndet, u.data() + j * n + k * ndet);
+      }
+
+      // Gaussian random numbers with the Box-Muller method
+      const double *u1 = u.data(), *u2 = u.data() + n;
+      const double *u3 = u.data() + 2 * n, *u4 = u.data() + 3 * n;
+      double *ge = gE.data(), *gt = gT.data();
+#pragma omp simd
+      for (unsigned int i = 0; i < n; i++) {
+         double s2, c2, s4, c4;
+         VectorMath::SinCos2Pi(u2[i], s2, c2);
+         VectorMath::SinCos2Pi(u4[i], s4, c4);
+         ge[i] = std::sqrt(-2. * VectorMath::Log(u1[i])) * c2;
+         gt[i] = std::sqrt(-2. * VectorMath::Log(u3[i])) * c4;
+      }
+
+      // Apply them to each detector of each event
+      for (unsigned int i = 0; i < n; i++) {
+         unsigned int d = i % ndet;
+         double *v = values + (i / ndet) * ndet * nperdet + d * nperdet;
+         double E = v[0];
+         if (E <= 0) continue;
+         double rootE = std::sqrt(E);
+         double Es = E + (e0[d] + e1[d] * E) * ge[i];
+         if (Es < threshold[d]) {
+            for (unsigned int j = 0; j < nperdet; j++) v[j] = 0;
+            continue;
+         }
+         v[0] = Es;
+         v[1] += (t0[d] + t1[d] / rootE) * gt[i] + w0[d] + w1[d] / rootE +
+           offset[d];
+      }
+   };
+};
+
+#endif
@@ -2,58 +2,111 @@
 #define __EVENT_ACTION_HH__
 
 #include <G4UserEventAction.hh>
+#include <G4RunManager.hh>
 #include <G4Threading.hh>
-#include <G4AutoLock.hh>
 
 #include "Datum.hh"
-
-#include <TTree.h>
+#include "EventContext.hh"
+#include "EventBlock.hh"
+#include "RootOutput.hh"
 
 //-----------------------------------------------------------------------------
-// Class to simulate listmode. We need an array of energies of type double,
-// which we pass to the constructor. A root file should already be open for
-// writing with a tree created and a branch for the energies
+// Class to simulate listmode. After each event, we append the data in the
+// event context of this thread to a block of events, which we hand over to
+// the root output when it is full. The output writes the tree on its own
+// thread, so we don't need to hold a lock while root fills and compresses it.
+// If the output tells us we have reached the target precision, we abort the
+// run of this thread after the current event. Each event goes into the block
+// with its start time and weight and the block belongs to the stream of this
+// thread, for time-ordered listmode. If a gamma was split in the event (see
+// SplittingOperator.hh), each branch of the event goes into the block as an
+// event of its own, sharing the weight of the event, times the factor the
+// Russian roulette gave the branch. Events and branches killed by the
+// roulette are counted but not written, and aborted events (e.g. when the
+// input file is used up) are neither written nor counted.
 class EventAction : public G4UserEventAction {
  private:
-   TTree *tree;
-   static G4Mutex mutex;
-   Datum *data;
-   int ndata;
-   
+   RootOutput *output;
+   EventContext *context; // Event context of this thread
+   EventBlock *block; // Block of events being filled by this thread
+   unsigned int stream; // Stream of this thread (thread ID)
+
  public:
 
    //--------------------------------------------------------------------------
-   // Constructor
-   EventAction(Datum *data_, int ndata_, TTree *tree_) {
-      tree = tree_;
-      ndata = ndata_;
-      data = data_;
+   // Constructor - this is called on the thread which uses the action, so we
+   // know its stream even if it never processes an event and only ends its
+   // runs
+   EventAction(RootOutput *output_) {
+      output = output_;
+      context = NULL;
+      block = NULL;
+      int thread = G4Threading::G4GetThreadId();
+      stream = (thread > 0) ? thread : 0;
    };
 
    // Destructor
    ~EventAction() {
+      Flush();
+   };
+
+   //--------------------------------------------------------------------------
+   // Hand the current block over to the output, even if it is not full. This
+   // should be called at the end of each run, with end_of_run set, so the
+   // output knows this stream has finished the run.
+   void Flush(bool end_of_run = false) {
+      if (block) output->Submit(block);
+      block = NULL;
+      if (end_of_run) output->EndRun(stream);
    };
 
    //--------------------------------------------------------------------------
-   // For each event, we fill the tree
-   virtual void EndOfEventAction(const G4Event *) {
+   // Copy the values (and tags) of an event to the block with its weight,
+   // getting a block to fill if we don't have one
+   void Add(Datum &d, double weight) {
+      if (!block) block = output->GetEmptyBlock(stream);
+      block->Add(d.GetPointer(), context->GetStart(), weight, d.GetTags());
+      if (block->IsFull()) Flush();
+   };
 
-      // Get the thread ID + 1 (-1 = master, others 0...N)
-      int thread = (G4Threading::G4GetThreadId() + 1);
+   //--------------------------------------------------------------------------
+   // For each event, we add the data to the block
+   virtual void EndOfEventAction(const G4Event *event) {
 
-      // We need to lock here, or root crashes
-      G4AutoLock l(&mutex);
+      // Get the event context of this thread
+      if (!context) context = EventContext::Get();
+      Datum &data = context->GetDatum();
 
-      // Copy the data from the thread-specific store to the root-
-      // specific store
-      data[0] = data[thread];
+      // An event killed by the roulette isn't written, but counts, while an
+      // aborted event (e.g. the input file was used up) doesn't count
+      if (context->IsKilled() || (event && event->IsAborted())) {
+         if (context->IsKilled()) context->CountEvent();
+         data.Reset();
+         for (unsigned int b = 1; b <= context->GetNBranches(); b++)
+           context->GetBranchDatum(b).Reset();
+         context->ResetBranches();
+         return;
+      }
 
-      // Fill the tree
-      tree->Fill();
+      // Copy the data from the thread-specific store to the block, or that
+      // of each branch the roulette left if the event was split
+      unsigned int nbranches = context->GetNBranches();
+      if (!nbranches) Add(data, context->GetWeight());
+      for (unsigned int b = 1; b <= nbranches; b++) {
+         Datum &branch = context->GetBranchDatum(b);
+         double factor = context->GetBranchFactor(b);
+         if (factor > 0)
+           Add(branch, context->GetWeight() * factor / nbranches);
+         branch.Reset();
+      }
 
       // Reset thread-specific data
-      data[thread].Reset();
+      data.Reset();
+      context->ResetBranches();
+      context->CountEvent();
+
+      // Stop if we have reached the target precision
+      if (output->IsDone()) G4RunManager::GetRunManager()->AbortRun(true);
    };
 };
-G4Mutex EventAction::mutex = G4MUTEX_INITIALIZER;
 #endif
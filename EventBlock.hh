@@ -0,0 +1,124 @@
+// Class to hold a block of events, each of which is the contents of a Datum
+// packed into a record of the layout of the output (see RecordLayout.hh), so
+// a float layout halves the block. A worker thread fills a block on its
+// own and only hands it over to the output when it is full, so it does not
+// have to take a lock for every event. For time-ordered listmode, the block
+// also has the start time of each event and the stream (worker) it came
+// from. With stratified sampling, it also has the weight of each event. If
+// the layout has the tags, they are packed into the record after the values.
+
+#ifndef __EVENT_BLOCK_HH__
+#define __EVENT_BLOCK_HH__
+
+#include <stdint.h>
+
+#include "RecordLayout.hh"
+
+//-----------------------------------------------------------------------------
+// Class for a block of events
+class EventBlock {
+
+ private:
+   const RecordLayout *layout; // Layout of the records
+   char *records;         // Records of all the events in the block
+   unsigned int size;     // Size of a record in bytes
+   int64_t *start;        // Start time of each event in ps
+   double *weight;        // Weight of each event
+   unsigned int nevents;  // Number of events currently in the block
+   unsigned int capacity; // Maximum number of events in the block
+   unsigned int stream;   // Stream the block belongs to
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Constructor
+   EventBlock(const RecordLayout *layout_, unsigned int capacity_) {
+      layout = layout_;
+      size = layout->GetSize();
+      capacity = capacity_;
+      nevents = 0;
+      stream = 0;
+      records = new char[size * capacity];
+      start = new int64_t[capacity];
+      weight = new double[capacity];
+   };
+
+   //--------------------------------------------------------------------------
+   // Destructor
+   ~EventBlock() {
+      delete [] records;
+      delete [] start;
+      delete [] weight;
+   };
+
+   //--------------------------------------------------------------------------
+   // Empty the block
+   void Clear() {
+      nevents = 0;
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the number of events in the block
+   unsigned int GetNEvents() {
+      return(nevents);
+   };
+
+   //--------------------------------------------------------------------------
+   // Is the block full?
+   bool IsFull() {
+      return(nevents >= capacity);
+   };
+
+   //--------------------------------------------------------------------------
+   // Unpack the values of the nth event into v
+   void GetEvent(unsigned int n, double *v) {
+      layout->Unpack(records + n * size, v);
+   };
+
+   //--------------------------------------------------------------------------
+   // Unpack the tags of the nth event into t (the layout must have them)
+   void GetTags(unsigned int n, uint16_t *t) {
+      layout->UnpackTags(records + n * size, t);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the start time in ps of the nth event
+   int64_t GetStart(unsigned int n) {
+      return(start[n]);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the weight of the nth event
+   double GetWeight(unsigned int n) {
+      return(weight[n]);
+   };
+
+   //--------------------------------------------------------------------------
+   // Set the stream the block belongs to
+   void SetStream(unsigned int stream_) {
+      stream = stream_;
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the stream the block belongs to
+   unsigned int GetStream() {
+      return(stream);
+   };
+
+   //--------------------------------------------------------------------------
+   // Append an event, packing the values of a Datum from the pointer given,
+   // which starts at the given time in ps and has the given weight, and its
+   // tags if the layout has them
+   void Add(const double *event, int64_t start_ = 0, double weight_ = 1,
+            const uint16_t *tags = NULL) {
+      if (nevents >= capacity) return;
+      layout->Pack(event, records + nevents * size);
+      if (layout->IsTagged())
+        layout->PackTags(tags, records + nevents * size);
+      start[nevents] = start_;
+      weight[nevents] = weight_;
+      nevents++;
+   };
+};
+
+#endif
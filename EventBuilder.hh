@@ -0,0 +1,251 @@
+// Class to build time-ordered listmode events from the simulated decays. In
+// this mode, each decay has a start time, given as an integer number of ps
+// (see PrimaryGenerator.hh), and the times of the hits stored by the
+// sensitive detectors are relative to it. So the absolute time of a hit is the
+// integer start plus a double, which is small, and we never lose the
+// picosecond precision, however long the run is.
+//
+// The decays have to be given to us in order of their start times (see
+// RootOutput.hh, which merges the streams of the workers). The hits of a decay
+// can come after the start of later decays, so we keep them in a priority
+// queue until the start of the decay we have been given has passed them, as
+// no later decay can give an earlier hit. So the queue only holds the hits of
+// the last few decays.
+//
+// The hits then go through two stages in time order:
+//
+// 1) Pile-up: for each detector, any hit within the pile-up window of the
+//    first hit is added to it (energies summed, time and position of the
+//    first hit).
+// 2) Coincidences: an event starts with the first hit and includes all the
+//    hits within the coincidence window after it. If a detector is hit twice
+//    in an event, that is also counted as pile-up.
+//
+// Each event has the same values as the normal output, with times relative
+// to the start of the event, plus the absolute start time in ps and the
+// number of piled-up hits.
+
+#ifndef __EVENT_BUILDER_HH__
+#define __EVENT_BUILDER_HH__
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <queue>
+#include <functional>
+#include <stdint.h>
+
+//-----------------------------------------------------------------------------
+// A hit in a detector with its absolute time split into integer ps (tick) and
+// a fraction
+struct Hit {
+   int64_t tick;       // Integer part of time in ps
+   double frac;        // Fractional part of time in ps
+   unsigned int det;   // Detector
+   unsigned int npile; // Number of hits piled up onto this one
+   double E, x, y, z;  // Energy and position
+
+   //--------------------------------------------------------------------------
+   // Time order, for the priority queue
+   bool operator>(const Hit &h) const {
+      return(tick > h.tick || (tick == h.tick && frac > h.frac));
+   };
+
+   //--------------------------------------------------------------------------
+   // Time since another hit in ps
+   double Since(const Hit &h) const {
+      return((double)(tick - h.tick) + (frac - h.frac));
+   };
+};
+
+//-----------------------------------------------------------------------------
+// Class for the event builder
+class EventBuilder {
+
+ private:
+   unsigned int ndet;            // Number of detectors
+   unsigned int nperdet;         // Number of values per detector
+   double window;                // Coincidence window in ps
+   double pileup;                // Pile-up window in ps
+   int64_t last;                 // Latest time we have seen in ps
+   std::priority_queue <Hit, std::vector <Hit>, std::greater <Hit> > sorter;
+   std::vector <Hit> pending;    // Hit in each detector in pile-up stage
+   std::vector <bool> has_pending; // Does each detector have a pending hit?
+   bool open;                    // Do we have an event being built?
+   Hit first;                    // First hit of the event being built
+   std::vector <double> values;  // Values of the event being built
+   unsigned int npile;           // Number of piled-up hits in the event
+   std::vector <double> ready;   // Values of the events which are ready
+   std::vector <int64_t> ready_start;        // Start of the ready events
+   std::vector <unsigned int> ready_pileup;  // Pile-up of the ready events
+
+   //--------------------------------------------------------------------------
+   // Finish the event being built
+   void Close() {
+      if (!open) return;
+      ready.insert(ready.end(), values.begin(), values.end());
+      ready_start.push_back(first.tick);
+      ready_pileup.push_back(npile);
+      open = false;
+   };
+
+   //--------------------------------------------------------------------------
+   // Coincidence stage - add a hit to the event being built or start a new
+   // one. The hits must come in time order.
+   void Coincide(const Hit &h) {
+      if (open && h.Since(first) > window) Close();
+      if (!open) {
+         open = true;
+         first = h;
+         npile = 0;
+         memset(values.data(), 0, sizeof(double) * values.size());
+      }
+      double *v = values.data() + h.det * nperdet;
+      npile += h.npile;
+      if (v[0] > 0) {
+         v[0] += h.E;
+         npile++;
+         return;
+      }
+      v[0] = h.E;
+      v[1] = (double)(h.tick - first.tick) + h.frac; // Relative to the start
+      if (nperdet > 4) {
+         v[2] = h.x;
+         v[3] = h.y;
+         v[4] = h.z;
+      }
+   };
+
+   //--------------------------------------------------------------------------
+   // Pass the pending hits which started before the given time minus the
+   // pile-up window to the coincidence stage, earliest first. With all set,
+   // pass all of them.
+   void Release(const Hit *h) {
+      while(1) {
+         int next = -1;
+         for (unsigned int d = 0; d < ndet; d++) {
+            if (!has_pending[d]) continue;
+            if (h && h->Since(pending[d]) <= pileup) continue;
+            if (next < 0 || pending[next] > pending[d]) next = d;
+         }
+         if (next < 0) return;
+         has_pending[next] = false;
+         Coincide(pending[next]);
+      }
+   };
+
+   //--------------------------------------------------------------------------
+   // Pile-up stage - add a hit to the pending hit of its detector or make it
+   // the pending hit. The hits must come in time order.
+   void PileUp(const Hit &h) {
+      Release(&h);
+      if (has_pending[h.det]) {
+         pending[h.det].E += h.E;
+         pending[h.det].npile++;
+         return;
+      }
+      pending[h.det] = h;
+      has_pending[h.det] = true;
+   };
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Constructor - coincidence and pile-up windows in ps
+   EventBuilder(unsigned int ndet_, unsigned int nperdet_, double window_,
+                double pileup_) {
+      ndet = ndet_;
+      nperdet = nperdet_;
+      window = window_;
+      pileup = pileup_;
+      last = 0;
+      pending.resize(ndet);
+      has_pending.assign(ndet, false);
+      open = false;
+      npile = 0;
+      values.assign(ndet * nperdet, 0);
+   };
+
+   //--------------------------------------------------------------------------
+   // Add a decay which starts at the given time in ps, with the values stored
+   // by the sensitive detectors (times relative to the start). The decays
+   // must be added in order of their start times.
+   void AddEvent(int64_t start, const double *event) {
+
+      // Put the hits in the queue
+      for (unsigned int d = 0; d < ndet; d++) {
+         const double *v = event + d * nperdet;
+         if (v[0] <= 0) continue;
+         Hit h;
+         double t = floor(v[1]);
+         h.tick = start + (int64_t)t;
+         h.frac = v[1] - t;
+         h.det = d;
+         h.npile = 0;
+         h.E = v[0];
+         h.x = (nperdet > 4) ? v[2] : 0;
+         h.y = (nperdet > 4) ? v[3] : 0;
+         h.z = (nperdet > 4) ? v[4] : 0;
+         sorter.push(h);
+         if (h.tick > last) last = h.tick;
+      }
+      if (start > last) last = start;
+
+      // Hits before this start are in their final order
+      while (!sorter.empty() && sorter.top().tick < start) {
+         PileUp(sorter.top());
+         sorter.pop();
+      }
+   };
+
+   //--------------------------------------------------------------------------
+   // Process everything we have, e.g. at the end of a run
+   void Flush() {
+      while (!sorter.empty()) {
+         PileUp(sorter.top());
+         sorter.pop();
+      }
+      Release(NULL);
+      Close();
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the latest time we have seen in ps
+   int64_t GetLast() {
+      return(last);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the number of events which are ready
+   unsigned int GetNReady() {
+      return(ready_start.size());
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the values of the nth ready event
+   const double *GetReady(unsigned int n) {
+      return(ready.data() + n * ndet * nperdet);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the start time in ps of the nth ready event
+   int64_t GetReadyStart(unsigned int n) {
+      return(ready_start[n]);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the number of piled-up hits of the nth ready event
+   unsigned int GetReadyPileup(unsigned int n) {
+      return(ready_pileup[n]);
+   };
+
+   //--------------------------------------------------------------------------
+   // Forget the ready events once they have been written
+   void ClearReady() {
+      ready.clear();
+      ready_start.clear();
+      ready_pileup.clear();
+   };
+};
+
+#endif
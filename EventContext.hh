@@ -0,0 +1,422 @@
+// Class to hold everything a thread needs for an event: the Datum which is
+// handed to the output, the sums accumulated by the sensitive detectors,
+// the random number engine of the thread, the start time of the event (for
+// time-ordered listmode), the weight of the event (for stratified sampling
+// and Russian roulette) and some statistics, including the gammas which the
+// primary generator skipped because they couldn't reach a detector, which we
+// need for the normalisation. When a gamma is split (see
+// SplittingOperator.hh), the event has a branch for each copy and the context
+// also has a Datum and a weight factor for each branch, which the Russian
+// roulette of the splitting multiplies (0 once the branch is killed). The
+// roulette can also kill the whole event. If we tag the deposits (see
+// SensitiveDetector.hh), it also has the transition and the energy of each
+// primary of the event and the primary each track comes from, which the
+// tracking action notes (see TrackingAction.hh). There is one instance per
+// thread, which is created by that thread the first time it asks for it, so
+// the memory is local to the core it is running on (first touch).
+// The instances are aligned to a cache line and the Datum values and the sums
+// are allocated in whole cache lines, so the threads never write to the same
+// cache line as each other (false sharing).
+
+#ifndef __EVENT_CONTEXT_HH__
+#define __EVENT_CONTEXT_HH__
+
+#include <G4Threading.hh>
+#include <G4AutoLock.hh>
+#include <Randomize.hh>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <new>
+#include <stdint.h>
+
+#include "Datum.hh"
+#include "MemoryAccount.hh"
+
+//-----------------------------------------------------------------------------
+// Sums accumulated by a sensitive detector during an event
+struct Accumulator {
+   double sumE; // Energy sum
+   double sumT; // Time
+   double sumN; // Number of hits
+   double sumX; // Sum over X-coordinate
+   double sumY; // Sum over Y-coordinate
+   double sumZ; // Sum over Z-coordinate
+
+   //--------------------------------------------------------------------------
+   // Zero the sums
+   void Reset() {
+      sumE = sumT = sumN = sumX = sumY = sumZ = 0;
+   };
+
+   //--------------------------------------------------------------------------
+   // Add the sums of another accumulator
+   void Add(const Accumulator &a) {
+      sumE += a.sumE;
+      sumT += a.sumT;
+      sumN += a.sumN;
+      sumX += a.sumX;
+      sumY += a.sumY;
+      sumZ += a.sumZ;
+   };
+};
+
+//-----------------------------------------------------------------------------
+// Class for the per-thread event context
+class alignas(64) EventContext {
+
+ private:
+   Datum data;                        // Data for current event
+   Accumulator *sums;                 // Sums for each detector
+   Datum *branches;                   // Data for each branch (splitting)
+   double *factors;                   // Weight factor of each branch
+   unsigned int nbranches;            // Branches of current event (0 = none)
+   bool killed;                       // Current event killed by roulette?
+   CLHEP::HepRandomEngine *engine;    // Random number engine of this thread
+   unsigned long long nevents;        // Number of events processed
+   unsigned long long nskipped;       // Number of unreachable gammas skipped
+   unsigned long long nempty;         // Events with no reachable gamma
+   int64_t start;                     // Start time of current event in ps
+   double weight;                     // Weight of current event
+   int thread;                        // Thread ID (-1 = master)
+   std::vector <uint16_t> lines;      // Transition of each primary (tags)
+   std::vector <double> energies;     // Energy of each primary in keV
+   std::vector <int> origin;          // Primary of each track (-1 = none)
+   long reported;                     // Bytes of these reported
+
+   static unsigned int ndet;          // Number of detectors
+   static unsigned int nperdet;       // Number of values per detector
+   static unsigned int nsplit;        // Splitting factor (0 = no splitting)
+   static bool tagging;               // Do we tag the deposits?
+   static G4ThreadLocal EventContext *context; // Context of this thread
+   static std::vector <EventContext *> contexts; // All the contexts
+   static G4Mutex mutex;              // Lock for the list of contexts
+
+   //--------------------------------------------------------------------------
+   // Constructor - private, use Get() instead
+   EventContext() {
+      thread = G4Threading::G4GetThreadId();
+      data.SetDimensions(ndet, nperdet, tagging);
+      void *p = NULL;
+      size_t size = sizeof(Accumulator) * (ndet ? ndet : 1);
+      if (posix_memalign(&p, 64, (size + 63) / 64 * 64)) p = NULL;
+      sums = (Accumulator *)p;
+      for (unsigned int i = 0; i < ndet; i++) sums[i].Reset();
+      branches = nsplit ? new Datum[nsplit] : NULL;
+      factors = nsplit ? new double[nsplit] : NULL;
+      for (unsigned int i = 0; i < nsplit; i++) {
+         branches[i].SetDimensions(ndet, nperdet, tagging);
+         factors[i] = 1;
+      }
+      nbranches = 0;
+      killed = false;
+      engine = G4Random::getTheEngine();
+      nevents = nskipped = nempty = 0;
+      start = 0;
+      weight = 1;
+      reported = 0;
+      MemoryAccount::Add(kMemoryContext, sizeof(EventContext) +
+                         (size + 63) / 64 * 64 + (nsplit + 1) *
+                         (sizeof(double) * ndet * nperdet + 63) / 64 * 64 +
+                         nsplit * sizeof(double));
+   };
+
+   //--------------------------------------------------------------------------
+   // Destructor
+   ~EventContext() {
+      free(sums);
+      if (branches) delete [] branches;
+      if (factors) delete [] factors;
+   };
+
+   //--------------------------------------------------------------------------
+   // Aligned allocation, so that the context starts on a cache line
+   static void *operator new(size_t size) {
+      void *p = NULL;
+      if (posix_memalign(&p, 64, size)) throw std::bad_alloc();
+      return(p);
+   };
+
+   //--------------------------------------------------------------------------
+   // Matching deallocation
+   static void operator delete(void *p) {
+      free(p);
+   };
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Set the dimensions of the data. This must be called before any thread
+   // gets its context.
+   static void SetDimensions(unsigned int ndet_, unsigned int nperdet_) {
+      ndet = ndet_;
+      nperdet = nperdet_;
+   };
+
+   //--------------------------------------------------------------------------
+   // Set the splitting factor, i.e. the number of branches of an event in
+   // which a gamma is split. This must be called before any thread gets its
+   // context.
+   static void SetSplitting(unsigned int nsplit_) {
+      nsplit = nsplit_;
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the splitting factor (0 = no splitting)
+   static unsigned int GetSplitting() {
+      return(nsplit);
+   };
+
+   //--------------------------------------------------------------------------
+   // Say whether we tag the deposits with the primary they come from. This
+   // must be called before any thread gets its context.
+   static void SetTagging(bool tagging_) {
+      tagging = tagging_;
+   };
+
+   //--------------------------------------------------------------------------
+   // Do we tag the deposits?
+   static bool GetTagging() {
+      return(tagging);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the context of the calling thread, creating it if necessary
+   static EventContext *Get() {
+      if (context) return(context);
+      context = new EventContext();
+      G4AutoLock l(&mutex);
+      contexts.push_back(context);
+      return(context);
+   };
+
+   //--------------------------------------------------------------------------
+   // Show the number of events processed by each thread
+   static void Show() {
+      G4AutoLock l(&mutex);
+      for (unsigned int i = 0; i < contexts.size(); i++) {
+         if (contexts[i]->thread < 0 && !contexts[i]->nevents) continue;
+         printf("Thread %3d: %llu events", contexts[i]->thread,
+                contexts[i]->nevents);
+         if (contexts[i]->nskipped)
+           printf(" (%llu unreachable gammas skipped, %llu events with none reachable)",
+                  contexts[i]->nskipped, contexts[i]->nempty);
+         printf("\n");
+      }
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the number of unreachable gammas skipped and of events with no
+   // reachable gamma by all the threads
+   static void GetSkipped(unsigned long long &skipped,
+                          unsigned long long &empty) {
+      G4AutoLock l(&mutex);
+      skipped = empty = 0;
+      for (unsigned int i = 0; i < contexts.size(); i++) {
+         skipped += contexts[i]->nskipped;
+         empty += contexts[i]->nempty;
+      }
+   };
+
+   //--------------------------------------------------------------------------
+   // Delete all the contexts. No thread may use its context after this.
+   static void DeleteAll() {
+      G4AutoLock l(&mutex);
+      for (unsigned int i = 0; i < contexts.size(); i++) delete contexts[i];
+      contexts.clear();
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the data for the current event
+   inline Datum &GetDatum() {
+      return(data);
+   };
+
+   //--------------------------------------------------------------------------
+   // Split the current event into a branch for each copy of a gamma
+   inline void Split() {
+      nbranches = nsplit;
+      for (unsigned int i = 0; i < nbranches; i++) factors[i] = 1;
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the number of branches of the current event (0 if it isn't split)
+   inline unsigned int GetNBranches() {
+      return(nbranches);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the data of a branch of the current event (1 to the number of
+   // branches)
+   inline Datum &GetBranchDatum(unsigned int branch) {
+      return(branches[branch - 1]);
+   };
+
+   //--------------------------------------------------------------------------
+   // Multiply the weight factor of a branch of the current event (1 to the
+   // number of branches), 0 to kill it
+   inline void ScaleBranch(unsigned int branch, double f) {
+      factors[branch - 1] *= f;
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the weight factor of a branch of the current event (0 if killed)
+   inline double GetBranchFactor(unsigned int branch) {
+      return(factors[branch - 1]);
+   };
+
+   //--------------------------------------------------------------------------
+   // Kill the current event, which is then counted but not written
+   inline void Kill() {
+      killed = true;
+   };
+
+   //--------------------------------------------------------------------------
+   // Was the current event killed?
+   inline bool IsKilled() {
+      return(killed);
+   };
+
+   //--------------------------------------------------------------------------
+   // Forget the branches and the roulette at the end of the event
+   inline void ResetBranches() {
+      nbranches = 0;
+      killed = false;
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the sums for the nth detector
+   inline Accumulator &GetAccumulator(unsigned int n) {
+      return(sums[n]);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the random number engine of this thread
+   inline CLHEP::HepRandomEngine *GetEngine() {
+      return(engine);
+   };
+
+   //--------------------------------------------------------------------------
+   // Count an event
+   inline void CountEvent() {
+      nevents++;
+   };
+
+   //--------------------------------------------------------------------------
+   // Count unreachable gammas which were skipped
+   inline void CountSkipped(unsigned int n) {
+      nskipped += n;
+   };
+
+   //--------------------------------------------------------------------------
+   // Count an event with no reachable gamma
+   inline void CountEmpty() {
+      nempty++;
+   };
+
+   //--------------------------------------------------------------------------
+   // Set the start time of the current event in ps
+   inline void SetStart(int64_t start_) {
+      start = start_;
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the start time of the current event in ps
+   inline int64_t GetStart() {
+      return(start);
+   };
+
+   //--------------------------------------------------------------------------
+   // Set the weight of the current event
+   inline void SetWeight(double weight_) {
+      weight = weight_;
+   };
+
+   //--------------------------------------------------------------------------
+   // Multiply the weight of the current event (Russian roulette)
+   inline void ScaleWeight(double f) {
+      weight *= f;
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the weight of the current event
+   inline double GetWeight() {
+      return(weight);
+   };
+
+   //--------------------------------------------------------------------------
+   // Forget the primaries and the tracks of the last event, accounting for
+   // the memory of their lists, which only grow
+   void ClearPrimaries() {
+      MemoryAccount::Update(kMemoryContext, reported,
+                            sizeof(uint16_t) * lines.capacity() +
+                            sizeof(double) * energies.capacity() +
+                            sizeof(int) * origin.capacity());
+      lines.clear();
+      energies.clear();
+      origin.clear();
+   };
+
+   //--------------------------------------------------------------------------
+   // Add a primary with the number of its transition (0 = not known) and its
+   // energy in keV. Geant4 numbers the tracks of the primaries from 1 in the
+   // order they are added to the event, so they must be added in that order.
+   inline void AddPrimary(uint16_t line, double energy) {
+      lines.push_back(line);
+      energies.push_back(energy);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the number of primaries of the current event
+   inline unsigned int GetNPrimaries() {
+      return(lines.size());
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the number of the transition of the nth primary
+   inline uint16_t GetPrimaryLine(unsigned int n) {
+      return(lines[n]);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the energy of the nth primary in keV
+   inline double GetPrimaryEnergy(unsigned int n) {
+      return(energies[n]);
+   };
+
+   //--------------------------------------------------------------------------
+   // Note the primary a track comes from, which is its own if it is a
+   // primary (no parent) or that of its parent, which is always tracked
+   // first
+   inline void SetOrigin(int id, int parent) {
+      if (id <= 0) return;
+      if ((unsigned int)id >= origin.size()) origin.resize(id + 1, -1);
+      if (!parent) origin[id] = id - 1;
+      else if ((unsigned int)parent < origin.size())
+        origin[id] = origin[parent];
+      else origin[id] = -1;
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the primary a track comes from (-1 if not known)
+   inline int GetOrigin(int id) {
+      if (id <= 0 || (unsigned int)id >= origin.size()) return(-1);
+      return(origin[id]);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the number of events processed by this thread
+   inline unsigned long long GetNEvents() {
+      return(nevents);
+   };
+};
+unsigned int EventContext::ndet = 0;
+unsigned int EventContext::nperdet = 0;
+unsigned int EventContext::nsplit = 0;
+bool EventContext::tagging = false;
+G4ThreadLocal EventContext *EventContext::context = NULL;
+std::vector <EventContext *> EventContext::contexts;
+G4Mutex EventContext::mutex = G4MUTEX_INITIALIZER;
+#endif
@@ -0,0 +1,351 @@
+// Class to read the primary events from a file written by another code, e.g.
+// cascades with angular correlations or beta-delayed emissions, instead of
+// generating them from the level scheme. The files can be much bigger than
+// the memory, so we stream them: a prefetch thread reads the events into
+// blocks and the primary generators of the workers (see PrimaryGenerator.hh)
+// each take a whole block and give it back when they have used it up, just
+// like the blocks of the output (see RootOutput.hh) in the other direction.
+// There is a fixed pool of blocks, a few per worker, and each block holds at
+// most blocksize events and maxvertices vertices, whatever the events are
+// like, and has the room for them from the start, so the memory is bounded
+// and known when the file is opened. The reader keeps the empty blocks
+// filled ahead of the workers, so a worker only waits if the disk can't keep
+// up. The number of times a worker had to wait is shown at the end.
+//
+// The file is binary, in the byte order of the machine (little endian on
+// x86), starting with the 4 characters "LBEV" and a 32-bit version (1). Then
+// each event is a 32-bit unsigned number of vertices, followed by 28 bytes
+// for each vertex:
+//
+// 8 bytes  double   time of the vertex in ps, relative to the event
+// 4 bytes  float    kinetic energy in keV
+// 12 bytes float[3] direction (unit vector)
+// 4 bytes  int32    PDG code of the particle (22 = gamma, 11 = electron...)
+//
+// All vertices are at the origin, as for the level scheme. The events are
+// handed out in the order of the file, but which worker gets which block
+// depends on the timing of the threads, so a run with an input file can't be
+// reproduced with per-event random number streams (see LaBr_timing.cc).
+// When the file is used up, the next event of each worker is aborted along
+// with the run (see EventAction.hh). An event with an absurd number of
+// vertices (more than a block can hold) means the file is corrupt, so it is
+// also treated as the end of the file.
+
+#ifndef __EVENT_INPUT_HH__
+#define __EVENT_INPUT_HH__
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "MemoryAccount.hh"
+
+//-----------------------------------------------------------------------------
+// A vertex of a primary event
+struct InputVertex {
+   double time;   // Time relative to the event in ps
+   double energy; // Kinetic energy in keV
+   double dx;     // Direction
+   double dy;
+   double dz;
+   int pdg;       // PDG code of the particle
+};
+
+//-----------------------------------------------------------------------------
+// A block of primary events
+class InputBlock {
+
+ private:
+   std::vector <unsigned int> first;    // Index of first vertex of each event
+   std::vector <unsigned int> nvertex;  // Number of vertices of each event
+   std::vector <InputVertex> vertices;  // All the vertices
+   unsigned int next;                   // Next event to pop
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Constructor - the most events and vertices the block can hold
+   InputBlock(unsigned int capacity, unsigned int maxvertices) {
+      first.reserve(capacity);
+      nvertex.reserve(capacity);
+      vertices.reserve(maxvertices);
+      next = 0;
+   };
+
+   //--------------------------------------------------------------------------
+   // Empty the block
+   void Clear() {
+      first.clear();
+      nvertex.clear();
+      vertices.clear();
+      next = 0;
+   };
+
+   //--------------------------------------------------------------------------
+   // Start a new event
+   void AddEvent() {
+      first.push_back(vertices.size());
+      nvertex.push_back(0);
+   };
+
+   //--------------------------------------------------------------------------
+   // Add a vertex to the last event
+   void AddVertex(const InputVertex &v) {
+      vertices.push_back(v);
+      nvertex.back()++;
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the number of events in the block
+   unsigned int GetNEvents() {
+      return(first.size());
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the number of vertices in the block
+   unsigned int GetNVertices() {
+      return(vertices.size());
+   };
+
+   //--------------------------------------------------------------------------
+   // Have we popped all the events?
+   bool IsEmpty() {
+      return(next >= first.size());
+   };
+
+   //--------------------------------------------------------------------------
+   // Pop the next event. Returns the number of vertices and a pointer to the
+   // first one.
+   unsigned int Pop(const InputVertex *&v) {
+      v = vertices.data() + first[next];
+      return(nvertex[next++]);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the bytes held by the block
+   long GetBytes() {
+      return((first.capacity() + nvertex.capacity()) * sizeof(unsigned int) +
+             vertices.capacity() * sizeof(InputVertex));
+   };
+};
+
+//-----------------------------------------------------------------------------
+// Class for the input file
+class EventInput {
+
+ private:
+   FILE *fp;                           // The file
+   std::vector <char> buffer;          // Buffer of the file
+   std::vector <char> raw;             // Vertices of an event as read
+   uint32_t nraw;                      // Number of vertices in raw
+   bool pending;                       // Is there an event in raw?
+   unsigned int blocksize;             // Number of events per block
+   unsigned int poolsize;              // Number of blocks per worker
+   unsigned int maxvertices;           // Number of vertices per block
+   std::vector <InputBlock *> blocks;  // All the blocks
+   std::deque <InputBlock *> full;     // Blocks ready for the workers
+   std::deque <InputBlock *> empty;    // Blocks for the reader to fill
+   std::mutex mutex;                   // Lock for the queues
+   std::condition_variable cond_full;  // Signalled when a block is full
+   std::condition_variable cond_empty; // Signalled when a block is free
+   std::thread reader;                 // Prefetch thread
+   bool running;                       // Is the reader running?
+   bool stop;                          // Tell the reader to finish
+   bool eof;                           // Has the reader reached the end?
+   unsigned long long nevents;         // Events read
+   unsigned long long nwaits;          // Times a worker waited for a block
+   long bytes;                         // Bytes of the blocks (fixed)
+   long reported;                      // Bytes reported to the accounting
+
+   //--------------------------------------------------------------------------
+   // Read the next event into raw. Returns false at the end of the file or
+   // if the last event is incomplete, which we drop.
+   bool ReadEvent() {
+      uint32_t n;
+      if (fread(&n, sizeof(n), 1, fp) != 1) return(false);
+      if (n > maxvertices) {
+         fprintf(stderr, "Event with %u vertices in the input (at most %u), treated as the end of the file\n",
+                 n, maxvertices);
+         return(false);
+      }
+      raw.resize(28 * (size_t)n);
+      if (n && fread(raw.data(), 28, n, fp) != n) {
+         fprintf(stderr, "Incomplete event at the end of the input\n");
+         return(false);
+      }
+      nraw = n;
+      return(true);
+   };
+
+   //--------------------------------------------------------------------------
+   // Add the event in raw to a block
+   void AddEvent(InputBlock *block) {
+      block->AddEvent();
+      for (uint32_t i = 0; i < nraw; i++) {
+         const char *v = raw.data() + 28 * (size_t)i;
+         InputVertex vertex;
+         float f[4];
+         int32_t pdg;
+         memcpy(&vertex.time, v, 8);
+         memcpy(f, v + 8, 16);
+         memcpy(&pdg, v + 24, 4);
+         vertex.energy = f[0];
+         vertex.dx = f[1];
+         vertex.dy = f[2];
+         vertex.dz = f[3];
+         vertex.pdg = pdg;
+         block->AddVertex(vertex);
+      }
+   };
+
+   //--------------------------------------------------------------------------
+   // The prefetch thread - fill each empty block in turn until we reach the
+   // end of the file or are told to stop. An event which doesn't fit in the
+   // vertices left in a block waits in raw for the next block.
+   void Reader() {
+      while(1) {
+
+         // Wait for an empty block
+         std::unique_lock <std::mutex> l(mutex);
+         cond_empty.wait(l, [this] { return(stop || !empty.empty()); });
+         if (stop) break;
+         InputBlock *block = empty.front();
+         empty.pop_front();
+         l.unlock();
+
+         // Fill it without holding the lock
+         bool more = true;
+         while (block->GetNEvents() < blocksize) {
+            if (!pending && !(more = ReadEvent())) break;
+            pending = true;
+            if (block->GetNVertices() + nraw > maxvertices) break;
+            AddEvent(block);
+            pending = false;
+         }
+
+         // Hand it over
+         l.lock();
+         nevents += block->GetNEvents();
+         if (block->GetNEvents()) full.push_back(block);
+         else empty.push_back(block);
+         if (!more) eof = true;
+         l.unlock();
+         cond_full.notify_all();
+         if (!more) break;
+      }
+   };
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Constructor
+   EventInput() {
+      fp = NULL;
+      blocksize = 1024;
+      poolsize = 4;
+      maxvertices = 16384;
+      nraw = 0;
+      pending = false;
+      running = stop = eof = false;
+      nevents = nwaits = 0;
+      bytes = reported = 0;
+   };
+
+   //--------------------------------------------------------------------------
+   // Destructor
+   ~EventInput() {
+      Close();
+      for (unsigned int i = 0; i < blocks.size(); i++) delete blocks[i];
+   };
+
+   //--------------------------------------------------------------------------
+   // Open the file, check its header and start the prefetch thread with
+   // enough blocks for each of nthreads workers to have one in use and a few
+   // ready, which is all the memory the input will use. Returns false if the
+   // file can't be read.
+   bool Open(const char *filename, unsigned int nthreads) {
+      fp = fopen(filename, "rb");
+      if (!fp) {
+         fprintf(stderr, "Unable to open event file %s\n", filename);
+         return(false);
+      }
+      buffer.resize(4 * 1024 * 1024);
+      setvbuf(fp, buffer.data(), _IOFBF, buffer.size());
+      char magic[4];
+      uint32_t version;
+      if (fread(magic, 4, 1, fp) != 1 || memcmp(magic, "LBEV", 4) ||
+          fread(&version, sizeof(version), 1, fp) != 1 || version != 1) {
+         fprintf(stderr, "%s is not an event file (version 1)\n", filename);
+         fclose(fp);
+         fp = NULL;
+         return(false);
+      }
+      for (unsigned int i = 0; i < poolsize * nthreads + 2; i++) {
+         blocks.push_back(new InputBlock(blocksize, maxvertices));
+         empty.push_back(blocks.back());
+         bytes += blocks.back()->GetBytes();
+      }
+      MemoryAccount::Update(kMemoryInput, reported, buffer.size() + bytes);
+      stop = eof = false;
+      reader = std::thread(&EventInput::Reader, this);
+      running = true;
+      return(true);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get a full block for a worker, waiting if the reader hasn't filled one
+   // yet. Returns NULL if the file is used up.
+   InputBlock *GetFullBlock() {
+      std::unique_lock <std::mutex> l(mutex);
+      if (full.empty() && !eof) {
+         nwaits++;
+         cond_full.wait(l, [this] { return(eof || !full.empty()); });
+      }
+      if (full.empty()) return(NULL);
+      InputBlock *block = full.front();
+      full.pop_front();
+      return(block);
+   };
+
+   //--------------------------------------------------------------------------
+   // Give a used block back to the reader
+   void Release(InputBlock *block) {
+      block->Clear();
+      std::unique_lock <std::mutex> l(mutex);
+      empty.push_back(block);
+      l.unlock();
+      cond_empty.notify_one();
+   };
+
+   //--------------------------------------------------------------------------
+   // Stop the prefetch thread and close the file
+   void Close() {
+      if (running) {
+         std::unique_lock <std::mutex> l(mutex);
+         stop = true;
+         l.unlock();
+         cond_empty.notify_one();
+         reader.join();
+         running = false;
+      }
+      if (fp) fclose(fp);
+      fp = NULL;
+   };
+
+   //--------------------------------------------------------------------------
+   // Show the events read and how often a worker had to wait for them and
+   // report the memory of the blocks. This must be called on the master.
+   void Show() {
+      std::unique_lock <std::mutex> l(mutex);
+      MemoryAccount::Update(kMemoryInput, reported, buffer.size() + bytes);
+      printf("Event input: %llu events read%s, workers waited %llu times\n",
+             nevents, eof ? " (end of file)" : "", nwaits);
+   };
+};
+
+#endif
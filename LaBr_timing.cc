@@ -9,102 +9,382 @@
 #include <G4UIExecutive.hh>
 #include <Randomize.hh>
   
-#include <TFile.h>
-#include <TTree.h>
 #include <TH2F.h>
 #include <TString.h>
 
 #include <cstdio>
+#include <cstring>
 #include <ctime>
+#include <vector>
 
-#include "Datum.hh"
+#include "AcceptanceMap.hh"
+#include "CachedProcess.hh"
+#include "CascadeBlock.hh"
 #include "DetectorConstruction.hh"
+#include "DetectorResponse.hh"
+#include "EventBuilder.hh"
+#include "EventContext.hh"
+#include "EventInput.hh"
+#include "LevelScheme.hh"
+#include "LiveStatus.hh"
+#include "MemoryAccount.hh"
 #include "PhysicsList.hh"
+#include "RandomSetup.hh"
+#include "RecordLayout.hh"
+#include "RootOutput.hh"
+#include "SplittingOperator.hh"
+#include "TimePickoff.hh"
 #include "UserActionInitialization.hh"
 
 //-----------------------------------------------------------------------------
 int main(int argc, char **argv) {
 
-   int c, nthreads = 3, ndet = 6;
+   int c, nthreads = 3, ndet = 6, pin = 0, status = 0, minimum = 0, split = 0;
+   long nevents = -1;
    const char *filename = "LaBr_timing.root";
    const char *levelscheme = "levelscheme.dat";
+   const char *inputfile = NULL;
+   const char *responsefile = NULL;
+   const char *gatefile = "gates.dat";
+   const char *livename = NULL;
+   const char *config = NULL;
+   std::vector <const char *> macros;
+   double target = 0, activity = 0, window = 20000, pileup = 100000;
+   bool pairs = true;
    extern char *optarg;
-   bool visualise = false;
-   
-   // Set random number generator to Ranlux
-   G4Random::setTheEngine(new CLHEP::RanluxEngine);
-   G4Random::setTheSeed((long)time(NULL), 3);
-   G4Random::showEngineStatus();
+   bool visualise = false, memory = false, skip = false, cache = false;
+   RootOutput *output = new RootOutput();
+   RandomSetup *random = new RandomSetup();
+   TimePickoff *pickoff = NULL;
+   RecordLayout layout;
+
+   // Seed from the time unless the user gives a seed
+   random->SetSeed((long)time(NULL));
 
    // Handle arguments
    while(1) {
-      c = getopt(argc, argv, "l:n:o:t:v");
+      c = getopt(argc, argv,
+                 "a:A:b:B:c:Cd:e:g:i:l:L:m:Mn:o:p:P:r:s:St:T:uvw:x:");
       if (c == -1) break;
 
       switch(c) {
+       case 'a': // Target precision in ps (and "all" for all pairs together)
+         target = atof(optarg);
+         pairs = !strstr(optarg, ":all");
+         break;
+       case 'A': // Activity in Bq for time-ordered listmode
+         activity = atof(optarg);
+         break;
+       case 'b': // Batch mode - number of events to run
+         nevents = atol(optarg);
+         if (nevents > 2147483647L) {
+            fprintf(stderr, "Geant4 can't run more than 2147483647 events "
+                    "in a run\n");
+            exit(-1);
+         }
+         break;
+       case 'B': // Split gammas scattering towards a crystal into N copies
+         split = atoi(optarg);
+         if (split < 2) {
+            fprintf(stderr, "The splitting factor must be at least 2\n");
+            exit(-1);
+         }
+         break;
+       case 'c': // Configuration macro (instead of init_terminal.mac)
+         config = optarg;
+         break;
+       case 'C': // Cache the cross sections at the level scheme energies
+         cache = true;
+         break;
+       case 'd': // Detector response to apply to the output
+         responsefile = optarg;
+         break;
+       case 'e': // Random number engine
+         if (!random->SetEngine(optarg)) exit(-1);
+         break;
+       case 'g': // Gates for the target precision
+         gatefile = optarg;
+         break;
+       case 'i': // Input file of primary events (instead of the level scheme)
+         inputfile = optarg;
+         break;
        case 'l': // Level scheme
          levelscheme = optarg;
          break;
+       case 'L': // Layout of the event record, e.g. et:float
+         if (!layout.Configure(optarg)) {
+            fprintf(stderr, "Bad record layout %s\n", optarg);
+            exit(-1);
+         }
+         break;
+       case 'm': // Shared memory to publish the status to
+         livename = optarg;
+         break;
+       case 'M': // Show the memory used by each subsystem on each thread
+         memory = true;
+         break;
        case 'n': // Number of detectors
          ndet = atoi(optarg);
          break;
        case 'o': // Output root file
          filename = optarg;
          break;
+       case 'p': // Pin worker threads to cores
+         pin = atoi(optarg);
+         break;
+       case 'P': // Stratified sampling - minimum of each path per block
+         minimum = atoi(optarg);
+         break;
+       case 'r': // Root output options
+         if (!output->Configure(optarg)) exit(-1);
+         break;
+       case 's': // Random number seed
+         random->SetSeed(atol(optarg));
+         break;
+       case 'S': // Per-event random number streams
+         random->SetStreams(true);
+         break;
        case 't': // Number of threads
          nthreads = atoi(optarg);
          break;
+       case 'T': // Time pickoff from the scintillation statistics
+         if (!pickoff) pickoff = new TimePickoff();
+         if (!pickoff->Configure(optarg)) exit(-1);
+         break;
+       case 'u': // Skip the gammas which can't reach a detector
+         skip = true;
+         break;
        case 'v': // Turn on visualisation
          visualise = true;
          break;
+       case 'w': // Coincidence and pile-up windows in ps
+         window = atof(optarg);
+         if (strchr(optarg, ':')) pileup = atof(strchr(optarg, ':') + 1);
+         break;
+       case 'x': // Macro to execute (can be given more than once)
+         macros.push_back(optarg);
+         break;
        default:
-         fprintf(stderr, "Usage: %s [-l levelscheme] [-n number_of_detectors] [-o output_rootfile] [-t nthreads] [-v]\n", argv[0]);
+         fprintf(stderr, "Usage: %s [-a target_ps[:all]] [-A activity_Bq] [-b number_of_events] [-B splitting_factor] [-c config_macro] [-C] [-d response_file] [-e engine[:luxury]] [-g gatefile] [-i event_file] [-l levelscheme] [-L record_layout] [-m shared_memory] [-M] [-n number_of_detectors] [-o output_rootfile] [-p pin_affinity] [-P minimum_per_path] [-r root_options] [-s seed] [-S] [-t nthreads] [-T pickoff_options] [-u] [-v] [-w window_ps[:pileup_ps]] [-x macro]...\n", argv[0]);
          exit(-1);
          break;
       }
    }
 
-   // Open a root file
-   TFile *f = TFile::Open(filename, "recreate");
-   
+   // Set up the random number engine
+   random->Show();
+   random->Initialise();
+
    // Create and set up a run manager
 #ifdef G4MULTITHREADED
    G4MTRunManager *run_manager = new G4MTRunManager();
 
    // Set number of threads
    run_manager->SetNumberOfThreads(nthreads);
+
+   // Optionally pin the worker threads to cores
+   if (pin) run_manager->SetPinAffinity(pin);
+
+   // Create the engine we want for each worker
+   run_manager->SetUserInitialization(new WorkerInitialization(random));
 #else
    G4RunManager *run_manager = new G4RunManager();
 #endif
 
-   // Reserve memory (one Datum per thread, including the master thread)
-   // Each datum should have space for energy and time for each detector
-   Datum *data = new Datum[run_manager->GetNumberOfThreads() + 1];
-   for (int i = 0; i < run_manager->GetNumberOfThreads() + 1; i++)
-     data[i].SetDimensions(ndet, 5);
+   // Each thread creates its own event context (and Datum) when it first
+   // needs it. Each datum should have space for energy and time and, unless
+   // the layout of the record drops it, the position for each detector
+   layout.SetNDetectors(ndet);
+   layout.Show();
+   unsigned int nperdet = layout.GetNPerDetector();
+   EventContext::SetDimensions(ndet, nperdet);
+
+   // If the layout has the tags, each deposit is tagged with the primary it
+   // comes from (see SensitiveDetector.hh). The event builder of
+   // time-ordered listmode doesn't keep them.
+   if (layout.IsTagged()) {
+      if (activity > 0) {
+         fprintf(stderr, "Tags can't be used with time-ordered listmode\n");
+         exit(-1);
+      }
+      EventContext::SetTagging(true);
+   }
+
+   // If we split the gammas which scatter towards a crystal, each event can
+   // have a branch for each copy, which is written as an event of its own
+   // with its share of the weight. The events of time-ordered listmode must
+   // be real decays, so we can't do both. The branches of an event are
+   // correlated, while the monitor treats each as an independent event, so
+   // it would stop before the target precision is really reached.
+   if (split) {
+      if (activity > 0) {
+         fprintf(stderr, "Splitting can't be used with time-ordered "
+                 "listmode\n");
+         exit(-1);
+      }
+      if (target > 0) {
+         fprintf(stderr, "Splitting can't be used with a target precision\n");
+         exit(-1);
+      }
+      printf("Splitting gammas scattering towards a crystal into %d copies\n",
+             split);
+      EventContext::SetSplitting(split);
+      output->SetWeighted(true);
+   }
    
-   // Create a tree   
-   TTree *tree = new TTree("g4", "geant4 tree");
-
-   // Create branch
-   tree->Branch("values", data[0].GetPointer(),
-    Form("values[%d]/D", data[0].GetNDetectors() * data[0].GetNPerDetector()));
-
-   // Set initialisation of run manager
-   run_manager->SetUserInitialization(new DetectorConstruction(data, ndet));
-   run_manager->SetUserInitialization(new PhysicsList());
-   run_manager->SetUserInitialization(new UserActionInitialization(data, ndet,
-                                                                   tree,
-                                                                   levelscheme));
+   // Read the detector response to apply to the output, if any (otherwise
+   // we write the true deposits)
+   DetectorResponse *response = NULL;
+   if (responsefile) {
+      response = new DetectorResponse(ndet, nperdet);
+      if (!response->Read(responsefile)) exit(-1);
+      response->Show();
+      output->SetResponse(response);
+   }
+
+   // Read the level scheme, which all the threads share, unless the events
+   // come from an input file. Stratified sampling and the cross-section
+   // cache need the level scheme. Which worker gets which events of the file
+   // depends on the timing of the threads, so per-event streams would pair
+   // the stream of an event with different primaries in each run and can't
+   // reproduce it.
+   LevelScheme *ls = new LevelScheme();
+   if (inputfile) {
+      if (minimum > 0 || cache) {
+         fprintf(stderr, "Stratified sampling and the cross-section cache "
+                 "need the level scheme, not an event file\n");
+         exit(-1);
+      }
+      if (random->GetStreams()) {
+         fprintf(stderr, "Per-event random number streams can't be used "
+                 "with an event file\n");
+         exit(-1);
+      }
+      printf("Reading the primary events from %s\n", inputfile);
+   } else {
+      if (!ls->Read(levelscheme)) exit(-1);
+      ls->Show();
+   }
+
+   // For stratified sampling, each block of cascades (see CascadeBlock.hh)
+   // has at least minimum of each path through the level scheme and the
+   // events have weights. The blocks of time-ordered listmode must keep the
+   // true rates, so we can't do both.
+   if (minimum > 0) {
+      if (activity > 0) {
+         fprintf(stderr, "Stratified sampling can't be used with "
+                 "time-ordered listmode\n");
+         exit(-1);
+      }
+      if (!ls->Stratify(minimum, kCascadeBlockSize)) exit(-1);
+      ls->ShowPaths();
+      output->SetWeighted(true);
+   }
+
+   // Show the time pickoff, if any (otherwise the time of a hit is the
+   // average time of the interactions)
+   if (pickoff) pickoff->Show();
+
+   // If we have a target precision, monitor the gated centroids and stop
+   // the run when they reach it (the number of events to run is then the
+   // maximum)
+   TimingAnalysis *monitor = NULL;
+   if (target > 0) {
+      monitor = new TimingAnalysis(ndet, nperdet, 10000, 5, false);
+      if (!monitor->Read(gatefile)) exit(-1);
+      if (!monitor->GetNGates()) {
+         fprintf(stderr, "No gates in %s to reach the target precision\n",
+                 gatefile);
+         exit(-1);
+      }
+      printf("Stopping when the centroids of %s reach %g ps (%s)\n",
+             gatefile, target, pairs ? "each pair" : "all pairs");
+      output->SetMonitor(monitor, target, pairs);
+   }
+
+   // For time-ordered listmode, build the events from the hits of the
+   // decays with the coincidence and pile-up windows
+   EventBuilder *builder = NULL;
+   if (activity > 0) {
+      builder = new EventBuilder(ndet, nperdet, window, pileup);
+      printf("Listmode: activity = %g Bq coincidence window = %g ps "
+             "pile-up window = %g ps\n", activity, window, pileup);
+      output->SetBuilder(builder);
+   }
+
+   // Publish the status of the run for the viewer, if requested
+   LiveStatus *live = NULL;
+   if (livename) {
+      live = new LiveStatus();
+      if (!live->Create(livename, ndet,
+                        run_manager->GetNumberOfThreads())) exit(-1);
+      printf("Publishing status to shared memory %s\n", livename);
+      output->SetLive(live);
+   }
+
+   // Open the root file and create the tree
+   output->Show();
+   if (!output->Open(filename, &layout,
+                     run_manager->GetNumberOfThreads())) exit(-1);
+
+   // Set initialisation of run manager. In listmode, each worker is a source
+   // with its share of the activity. The detector construction builds the
+   // acceptance map, if we want one, which the primary generators share.
+   double rate = activity / run_manager->GetNumberOfThreads();
+   AcceptanceMap *acceptance = skip ? new AcceptanceMap() : NULL;
+   EventInput *input = NULL;
+   if (inputfile) {
+      input = new EventInput();
+      if (!input->Open(inputfile, run_manager->GetNumberOfThreads()))
+        exit(-1);
+   }
+   run_manager->SetUserInitialization(new DetectorConstruction(ndet, pickoff,
+                                                               acceptance,
+                                                               split));
+   std::vector <double> energies;
+   if (cache) ls->GetEnergies(energies);
+   run_manager->SetUserInitialization(new PhysicsList(cache ? &energies :
+                                                      NULL, split > 0));
+   run_manager->SetUserInitialization(new UserActionInitialization(output,
+                                                                   ls, random,
+                                                                   rate,
+                                                                   acceptance,
+                                                                   split > 0,
+                                                                   input));
+   MemoryAccount::Mark("before initialisation");
    run_manager->Initialize();
+   MemoryAccount::Mark("after initialisation");
 
    // Get the user interface manager
    G4UImanager *UImanager = G4UImanager::GetUIpointer();
 
-   // If the user specified visualisation, create a visualisation manager
-   // and start it. Otherwise, if the user specified the number of events,
-   // run them and quit, and if not, start an interactive text-based sesssion.
-   if (visualise) {
+   // If the user specified the number of events, this is batch mode: execute
+   // the configuration and the other macros, run the events and quit, without
+   // any user interface, so we don't need a terminal. If the user specified
+   // visualisation, create a visualisation manager and start it. Otherwise,
+   // start an interactive text-based sesssion.
+   if (nevents >= 0) {
+
+      // Execute the macros, stopping at the first which fails
+      if (config) macros.insert(macros.begin(), config);
+      for (unsigned int i = 0; i < macros.size() && !status; i++) {
+         FILE *fp = fopen(macros[i], "r");
+         if (!fp) {
+            fprintf(stderr, "Unable to read macro %s\n", macros[i]);
+            status = 1;
+            break;
+         }
+         fclose(fp);
+         if (UImanager->ApplyCommand(G4String("/control/execute ") +
+                                     macros[i])) {
+            fprintf(stderr, "Macro %s failed\n", macros[i]);
+            status = 1;
+         }
+      }
+
+      // Run the events
+      if (!status && nevents > 0) run_manager->BeamOn(nevents);
+   } else if (visualise) {
 
       // Create a new visualisation manager
       G4VisManager *vis_manager = new G4VisExecutive();
@@ -128,8 +408,10 @@ int main(int argc, char **argv) {
       G4UIterminal *ui = new G4UIterminal(new G4UItcsh);
       ui->SetPrompt("LaBr_timing> ");
 
-      // Initialise terminal
-      UImanager->ExecuteMacroFile("init_terminal.mac");
+      // Initialise terminal and execute any other macros
+      UImanager->ExecuteMacroFile(config ? config : "init_terminal.mac");
+      for (unsigned int i = 0; i < macros.size(); i++)
+        UImanager->ExecuteMacroFile(macros[i]);
 
       // Switch to interactive
       ui->SessionStart();
@@ -138,16 +420,67 @@ int main(int argc, char **argv) {
       delete ui;
    }
 
-   // Write tree and all histograms
-   f->Write();
+   // Write tree and all histograms, with the number of gammas we skipped,
+   // which are part of the normalisation
+   if (!output->Write()) status = 1;
+   output->WriteParameter("values_per_detector", nperdet);
+
+   // Write the energy of each transition in keV with its number, so the
+   // tags can be read without the level scheme
+   if (layout.IsTagged())
+     for (unsigned int i = 0; i < ls->GetNTransitions(); i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "transition_%u", i + 1);
+        output->WriteParameter(name, ls->GetTransitionEnergy(i) / keV);
+     }
+   if (acceptance) {
+      unsigned long long skipped, empty;
+      EventContext::GetSkipped(skipped, empty);
+      printf("Skipped %llu unreachable gammas, %llu events with none "
+             "reachable (%.2f %% of the solid angle reachable)\n",
+             skipped, empty, acceptance->GetFraction() * 100.);
+      output->WriteParameter("gammas_skipped", skipped);
+      output->WriteParameter("events_skipped", empty);
+      output->WriteParameter("acceptance", acceptance->GetFraction());
+   }
+
+   // Show how well the cross-section cache did
+   if (cache) CachedProcess::Show();
+
+   // Show how many events we read and whether the workers had to wait
+   if (input) input->Show();
+
+   // Show how many gammas were split and write the splitting factor
+   if (split) {
+      SplitOperation::Show();
+      output->WriteParameter("splitting", split);
+   }
+
+   // Show the memory used, while the workers still exist
+   MemoryAccount::Mark("end of run");
+   if (memory) MemoryAccount::Show(run_manager->GetNumberOfThreads());
 
    // Clean up - this implicitly deletes the detector construction, physics
    // list, primary generator and sensitive detector, so do not do this
    // explictly or we will get a "double free" error.
    delete run_manager;
+   if (input) delete input;
 
-   delete [] data;
+   // Show how many events each thread processed and delete the contexts
+   EventContext::Show();
+   EventContext::DeleteAll();
+   MemoryAccount::DeleteAll();
 
    // Close root file
-   f->Close();
+   output->Close();
+   delete output;
+   if (response) delete response;
+   if (monitor) delete monitor;
+   if (builder) delete builder;
+   if (live) delete live;
+   if (pickoff) delete pickoff;
+   delete ls;
+   if (acceptance) delete acceptance;
+   delete random;
+   return(status);
 }
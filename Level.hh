@@ -18,19 +18,6 @@ class Level {
    std::vector <Transition *> transitions; // List of depopulating transitions
    double total_decay; // Total intensity of all depopulating transitions
 
-   //--------------------------------------------------------------------------
-   // Get the number of transitions which depopulate this level
-   inline unsigned int GetNTransitions() {
-      return(transitions.size());
-   };
-
-   //--------------------------------------------------------------------------
-   // Get the index of the nth transition which depopulates this level
-   Transition *GetTransition(unsigned int ind) {
-      if (ind >= transitions.size()) return(NULL);
-      return(transitions[ind]);
-   };
-
  public:
    
    //--------------------------------------------------------------------------
@@ -44,19 +31,19 @@ class Level {
    
    //--------------------------------------------------------------------------
    // Get the energy of the level
-   inline double GetEnergy() {
+   inline double GetEnergy() const {
       return(energy);
    };
 
    //--------------------------------------------------------------------------
    // Get the tau of the level
-   inline double GetTau() {
+   inline double GetTau() const {
       return(tau);
    };
    
    //--------------------------------------------------------------------------
    // Get the total population of the level from the reaction
-   inline double GetPopulation() {
+   inline double GetPopulation() const {
       return(population);
    };
 
@@ -67,17 +54,37 @@ class Level {
       total_decay += t->GetIntensity();
    };
 
+   //--------------------------------------------------------------------------
+   // Get the number of transitions which depopulate this level
+   inline unsigned int GetNTransitions() const {
+      return(transitions.size());
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the index of the nth transition which depopulates this level
+   Transition *GetTransition(unsigned int ind) const {
+      if (ind >= transitions.size()) return(NULL);
+      return(transitions[ind]);
+   };
+
    //--------------------------------------------------------------------------
    // Get the total gamma intensity decaying out of this level
-   inline double GetDecayIntensity() {
+   inline double GetDecayIntensity() const {
       return(total_decay);
    };
 
    //--------------------------------------------------------------------------
    // Pick a transition decaying from the level at random, weighted by the
    // intensities. We return its index.
-   Transition *PickDepopulatingTransition() {
-      double r = G4UniformRand() * GetDecayIntensity(), sum = 0;
+   Transition *PickDepopulatingTransition() const {
+      return(PickDepopulatingTransition(G4UniformRand()));
+   };
+
+   //--------------------------------------------------------------------------
+   // Pick a transition decaying from the level, given a flat random number u
+   // between 0 and 1, so that the caller can draw random numbers in bulk
+   Transition *PickDepopulatingTransition(double u) const {
+      double r = u * GetDecayIntensity(), sum = 0;
       for (unsigned int i = 0; i < GetNTransitions(); i++) {
          Transition *t = GetTransition(i);
          sum += t->GetIntensity();
@@ -88,10 +95,11 @@ class Level {
 
    //--------------------------------------------------------------------------
    // Show the depopulating transitions of the level
-   void Show() {
+   void Show() const {
       double decay = GetDecayIntensity();
       for (unsigned int i = 0; i < transitions.size(); i++) {
-         printf("\tTransition: energy = %7.2f keV intensity = %.2f %%\n",
+         printf("\tTransition %3u: energy = %7.2f keV intensity = %.2f %%\n",
+                transitions[i]->GetIndex() + 1,
                 transitions[i]->GetEnergy() / keV,
                 transitions[i]->GetIntensity() * 100. / decay);
       }
@@ -3,15 +3,46 @@
 // of the half life of the isotope (e.g. years) but we are interested in time
 // diffferences of a few picoseconds. Since the time is represented as a double
 // we don't have enough precision to do this.
+//
+// The level scheme is only read at the start, so it is read once on the
+// master and shared by all the worker threads, which only use the const
+// methods to walk through it.
+//
+// When it is read, we also enumerate all the paths through the level scheme,
+// from each level populated by the parent down to a stable level, with their
+// probabilities. For stratified sampling (see CascadeBlock.hh), each block of
+// cascades has at least a given number of each path, so the weak paths are
+// there in every block, and the rest of the block is drawn with the true
+// probabilities. Each path is then sampled with a known probability, so each
+// event gets the weight (true / sampled probability) which restores the
+// normalisation.
+//
+// The transitions are numbered from 1 in the order they are read, which is
+// how the tags of the deposits (see RecordLayout.hh) identify them.
 
 #ifndef __LEVEL_SCHEME_H__
 #define __LEVEL_SCHEME_H__
 
 #include <vector>
+#include <algorithm>
 #include <TString.h>
 
 #include "Transition.hh"
 #include "Level.hh"
+#include "MemoryAccount.hh"
+
+//-----------------------------------------------------------------------------
+// A path through the level scheme from a level populated by the parent to the
+// end of the cascade, with the energy of each gamma, the tau of the level it
+// populates and the index of its transition
+struct CascadePath {
+   double probability;          // True probability of the path
+   double sampling;             // Probability with which we sample it
+   double weight;               // Weight of each event (true / sampled)
+   std::vector <double> energy; // Energy of each gamma
+   std::vector <double> tau;    // Tau of level populated by each gamma
+   std::vector <unsigned int> line; // Index of transition of each gamma
+};
 
 //-----------------------------------------------------------------------------
 // Class for a level scheme
@@ -21,6 +52,12 @@ class LevelScheme {
    std::vector <Level *> levels;            // List of levels
    std::vector <Transition *> transitions;  // List of transitions
    double total_population;                 // Total population from parent
+   std::vector <CascadePath> paths;         // All the paths through it
+   std::vector <double> cumulative;         // Cumulative true probabilities
+   std::vector <double> cumulative_sampling; // ... and sampled probabilities
+   bool truncated;                          // Too many paths to enumerate?
+   unsigned int minimum;                    // Minimum of each path per block
+   unsigned int blocksize;                  // Cascades per block
 
    //--------------------------------------------------------------------------
    // Add a transition using the indices
@@ -29,7 +66,8 @@ class LevelScheme {
       if (!initial || !final) return;
 
       // Create the transition
-      Transition *t = new Transition(final, intensity, energy);
+      Transition *t = new Transition(final, intensity, energy,
+                                     transitions.size());
 
       // Add it to the level scheme
       transitions.push_back(t);
@@ -38,12 +76,78 @@ class LevelScheme {
       initial->AddTransition(t);
    };
 
+   //--------------------------------------------------------------------------
+   // Add all the paths from a level, which we reached with a given
+   // probability along the given path. A cascade ends at a stable level or
+   // one with nothing depopulating it, just as in CascadeBlock::Walk.
+   void AddPaths(const Level *level, double probability, CascadePath &path) {
+      if (paths.size() >= 100000 || path.energy.size() > levels.size()) {
+         truncated = true;
+         return;
+      }
+      if (level->GetTau() < 0 || level->GetDecayIntensity() <= 0) {
+         path.probability = path.sampling = probability;
+         path.weight = 1;
+         paths.push_back(path);
+         return;
+      }
+      for (unsigned int i = 0; i < level->GetNTransitions(); i++) {
+         const Transition *t = level->GetTransition(i);
+         if (t->GetIntensity() <= 0) continue;
+         path.energy.push_back(t->GetEnergy());
+         path.tau.push_back(t->GetFinal()->GetTau());
+         path.line.push_back(t->GetIndex());
+         AddPaths(t->GetFinal(), probability * t->GetIntensity() /
+                  level->GetDecayIntensity(), path);
+         path.energy.pop_back();
+         path.tau.pop_back();
+         path.line.pop_back();
+      }
+   };
+
+   //--------------------------------------------------------------------------
+   // Enumerate all the paths through the level scheme
+   void EnumeratePaths() {
+      paths.clear();
+      truncated = false;
+      CascadePath path;
+      for (unsigned int i = 0; i < levels.size() && total_population > 0; i++)
+        if (levels[i]->GetPopulation() > 0)
+          AddPaths(levels[i], levels[i]->GetPopulation() / total_population,
+                   path);
+      SetCumulative();
+   };
+
+   //--------------------------------------------------------------------------
+   // Set up the cumulative probabilities, so we can pick a path with a
+   // binary search
+   void SetCumulative() {
+      double sum = 0, sum_sampling = 0;
+      cumulative.resize(paths.size());
+      cumulative_sampling.resize(paths.size());
+      for (unsigned int i = 0; i < paths.size(); i++) {
+         cumulative[i] = (sum += paths[i].probability);
+         cumulative_sampling[i] = (sum_sampling += paths[i].sampling);
+      }
+   };
+
  public:
 
    //--------------------------------------------------------------------------
    // Constructor
    LevelScheme() {
       total_population = 0;
+      truncated = false;
+      minimum = 0;
+      blocksize = 0;
+   };
+
+   //--------------------------------------------------------------------------
+   // Destructor
+   ~LevelScheme() {
+      for (unsigned int i = 0; i < levels.size(); i++) delete levels[i];
+      for (unsigned int i = 0; i < transitions.size(); i++)
+        delete transitions[i];
    };
 
    //--------------------------------------------------------------------------
@@ -77,9 +181,108 @@ class LevelScheme {
       AddTransition(initial, final, intensity, E1 - E2);
    };
 
+   //--------------------------------------------------------------------------
+   // Get the number of transitions
+   inline unsigned int GetNTransitions() const {
+      return(transitions.size());
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the energy of the transition with the given index
+   inline double GetTransitionEnergy(unsigned int i) const {
+      return(transitions[i]->GetEnergy());
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the distinct energies of the transitions
+   void GetEnergies(std::vector <double> &energies) const {
+      energies.clear();
+      for (unsigned int i = 0; i < transitions.size(); i++) {
+         double E = transitions[i]->GetEnergy();
+         if (std::find(energies.begin(), energies.end(), E) == energies.end())
+           energies.push_back(E);
+      }
+   };
+
+   //--------------------------------------------------------------------------
+   // Guarantee at least minimum cascades of each path in each block of
+   // blocksize cascades. The rest of the block is drawn with the true
+   // probabilities, so path i is sampled with the probability
+   //
+   // q(i) = (minimum + (blocksize - minimum * npaths) * p(i)) / blocksize
+   //
+   // and its events have the weight p(i) / q(i). If the block can't hold
+   // minimum of every path, we lower the minimum. Returns false if the paths
+   // couldn't all be enumerated.
+   bool Stratify(unsigned int minimum_, unsigned int blocksize_) {
+      if (truncated || paths.empty() || blocksize_ == 0) {
+         fprintf(stderr, "Unable to enumerate the paths of the level scheme for stratified sampling\n");
+         return(false);
+      }
+      minimum = minimum_;
+      blocksize = blocksize_;
+      if ((unsigned long)minimum * paths.size() > blocksize) {
+         minimum = blocksize / paths.size();
+         printf("Only room for %u of each of the %u cascade paths in a block of %u\n",
+                minimum, (unsigned int)paths.size(), blocksize);
+      }
+      double rest = blocksize - (double)minimum * paths.size();
+      for (unsigned int i = 0; i < paths.size(); i++) {
+         CascadePath &p = paths[i];
+         p.sampling = (minimum + rest * p.probability) / blocksize;
+         p.weight = (p.sampling > 0) ? p.probability / p.sampling : 0;
+      }
+      SetCumulative();
+      return(true);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the minimum number of cascades of each path per block (0 = not
+   // stratified)
+   inline unsigned int GetMinimum() const {
+      return(minimum);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the number of cascades per block for stratified sampling
+   inline unsigned int GetBlockSize() const {
+      return(blocksize);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the paths through the level scheme
+   inline const std::vector <CascadePath> &GetPaths() const {
+      return(paths);
+   };
+
+   //--------------------------------------------------------------------------
+   // Pick a path, given a flat random number u between 0 and 1, either with
+   // the true probabilities or with the probabilities we sample with
+   unsigned int PickPath(double u, bool sampled) const {
+      const std::vector <double> &c = sampled ? cumulative_sampling : cumulative;
+      unsigned int i = std::upper_bound(c.begin(), c.end(), u * c.back()) -
+        c.begin();
+      return((i < c.size()) ? i : c.size() - 1);
+   };
+
+   //--------------------------------------------------------------------------
+   // Show the paths with their true and sampled probabilities and weights
+   void ShowPaths() const {
+      printf("%u cascade paths%s:\n", (unsigned int)paths.size(),
+             truncated ? " (too many, truncated)" : "");
+      for (unsigned int i = 0; i < paths.size(); i++) {
+         const CascadePath &p = paths[i];
+         printf("Path %4u: probability = %10.4g %% sampled = %10.4g %% weight = %10.4g gammas =",
+                i, p.probability * 100., p.sampling * 100., p.weight);
+         for (unsigned int j = 0; j < p.energy.size(); j++)
+           printf(" %.2f", p.energy[j] / keV);
+         printf(" keV\n");
+      }
+   };
+
    //--------------------------------------------------------------------------
    // Show the level scheme
-   void Show() {
+   void Show() const {
 
       // Loop over levels
       for (unsigned int i = 0; i < levels.size(); i++) {
@@ -101,8 +304,15 @@ class LevelScheme {
    //--------------------------------------------------------------------------
    // Pick a level for the primary population at random, weighted by the value
    // of the population given by the user. We return its index.
-   Level *PickPrimaryLevel() {
-      double r = G4UniformRand() * total_population, sum = 0;
+   Level *PickPrimaryLevel() const {
+      return(PickPrimaryLevel(G4UniformRand()));
+   };
+
+   //--------------------------------------------------------------------------
+   // Pick a level for the primary population, given a flat random number u
+   // between 0 and 1, so that the caller can draw random numbers in bulk
+   Level *PickPrimaryLevel(double u) const {
+      double r = u * total_population, sum = 0;
       for (unsigned int i = 0; i < levels.size(); i++) {
          sum += levels[i]->GetPopulation();
          if (r < sum) return(levels[i]);
@@ -112,14 +322,14 @@ class LevelScheme {
 
 
    //--------------------------------------------------------------------------
-   // Read the level scheme from a file
-   void Read(const char *filename) {
+   // Read the level scheme from a file. Returns false if we can't.
+   bool Read(const char *filename) {
 
       // Open the file
       FILE *fp = fopen(filename, "r");
       if (!fp) {
          fprintf(stderr, "Unable to read file %s\n", filename);
-         return;
+         return(false);
       }
       
       // Parse it
@@ -139,6 +349,23 @@ class LevelScheme {
 
       // Close the file
       fclose(fp);
+
+      // Enumerate the paths through it
+      EnumeratePaths();
+
+      // Account for the memory (each transition is also in the list of its
+      // initial level)
+      long bytes = levels.size() * sizeof(Level) +
+        transitions.size() * sizeof(Transition) +
+        (levels.capacity() + transitions.capacity() * 2) * sizeof(void *) +
+        paths.capacity() * sizeof(CascadePath) +
+        (cumulative.capacity() + cumulative_sampling.capacity()) *
+        sizeof(double);
+      for (unsigned int i = 0; i < paths.size(); i++)
+        bytes += (paths[i].energy.capacity() + paths[i].tau.capacity()) *
+          sizeof(double) + paths[i].line.capacity() * sizeof(unsigned int);
+      MemoryAccount::Add(kMemoryLevels, bytes);
+      return(true);
    }
 };
 
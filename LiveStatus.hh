@@ -0,0 +1,166 @@
+// Class to publish the status of a running simulation in a POSIX shared
+// memory segment, so that it can be watched with the viewer (see viewer.cc)
+// without disturbing it. The writer thread of the output (see RootOutput.hh)
+// is the only one which writes to the segment, about once a second, so the
+// workers don't do anything extra per event. It publishes the number of
+// events, the events from each worker thread, the lock statistics of the
+// block pool, the hits in each detector and the LaBr3 energy spectra.
+//
+// The segment is protected by a sequence lock: the writer makes the sequence
+// number odd while it is updating the data and even again when it has
+// finished. A reader copies the data and tries again if the sequence number
+// was odd or changed while it was copying, so neither side ever waits for
+// the other.
+
+#ifndef __LIVE_STATUS_HH__
+#define __LIVE_STATUS_HH__
+
+#include <TString.h>
+
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LIVE_MAGIC       0x4C614272  // "LaBr"
+#define LIVE_MAX_THREADS 256         // Maximum number of worker threads
+#define LIVE_MAX_DET     64          // Maximum number of detectors
+#define LIVE_NBINS       3000        // Number of bins of the spectra
+#define LIVE_EMAX        3000.       // Upper limit of the spectra in keV
+
+//-----------------------------------------------------------------------------
+// Layout of the shared memory segment
+struct LiveData {
+   uint32_t magic;                      // LIVE_MAGIC once set up
+   uint32_t ndet;                       // Number of detectors
+   uint32_t nthreads;                   // Number of worker threads
+   uint32_t pid;                        // Process ID of the simulation
+   std::atomic <uint64_t> sequence;     // Odd while being updated
+   double elapsed;                      // Time since the start in s
+   uint64_t nevents;                    // Number of events written
+   uint64_t nlocks;                     // Number of times the pool was locked
+   uint64_t ncontended;                 // ... of which it was already locked
+   uint64_t nwaits;                     // Times a worker waited for a block
+   double wait_time;                    // Total time waiting in s
+   uint64_t thread_events[LIVE_MAX_THREADS]; // Events from each thread
+   uint64_t hits[LIVE_MAX_DET];         // Hits in each detector
+   uint32_t spectra[LIVE_MAX_DET * LIVE_NBINS]; // Energy spectra
+};
+
+//-----------------------------------------------------------------------------
+// Class for the shared memory segment
+class LiveStatus {
+
+ private:
+   TString name;     // Name of the segment
+   LiveData *data;   // The mapped segment
+   bool owner;       // Did we create it?
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Constructor
+   LiveStatus() {
+      data = NULL;
+      owner = false;
+   };
+
+   //--------------------------------------------------------------------------
+   // Destructor - unmap the segment and remove it if we created it
+   ~LiveStatus() {
+      if (data) munmap(data, sizeof(LiveData));
+      if (owner) shm_unlink(name.Data());
+   };
+
+   //--------------------------------------------------------------------------
+   // Create the segment with the given name (e.g. /LaBr_timing). Returns
+   // false if we can't.
+   bool Create(const char *name_, unsigned int ndet, unsigned int nthreads) {
+      name = name_;
+      int fd = shm_open(name.Data(), O_CREAT | O_RDWR, 0644);
+      if (fd < 0 || ftruncate(fd, sizeof(LiveData)) < 0) {
+         fprintf(stderr, "Unable to create shared memory %s\n", name.Data());
+         if (fd >= 0) close(fd);
+         return(false);
+      }
+      void *p = mmap(NULL, sizeof(LiveData), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+      close(fd);
+      if (p == MAP_FAILED) {
+         fprintf(stderr, "Unable to map shared memory %s\n", name.Data());
+         return(false);
+      }
+      data = (LiveData *)p;
+      owner = true;
+      memset((void *)data, 0, sizeof(LiveData));
+      data->ndet = (ndet < LIVE_MAX_DET) ? ndet : LIVE_MAX_DET;
+      data->nthreads = (nthreads < LIVE_MAX_THREADS) ? nthreads :
+        LIVE_MAX_THREADS;
+      data->pid = getpid();
+      std::atomic_thread_fence(std::memory_order_release);
+      data->magic = LIVE_MAGIC;
+      return(true);
+   };
+
+   //--------------------------------------------------------------------------
+   // Attach to an existing segment for reading. Returns false if we can't.
+   bool Attach(const char *name_) {
+      name = name_;
+      int fd = shm_open(name.Data(), O_RDONLY, 0);
+      if (fd < 0) {
+         fprintf(stderr, "No shared memory %s - is the simulation running with -m?\n",
+                 name.Data());
+         return(false);
+      }
+      void *p = mmap(NULL, sizeof(LiveData), PROT_READ, MAP_SHARED, fd, 0);
+      close(fd);
+      if (p == MAP_FAILED) {
+         fprintf(stderr, "Unable to map shared memory %s\n", name.Data());
+         return(false);
+      }
+      data = (LiveData *)p;
+      if (data->magic != LIVE_MAGIC) {
+         fprintf(stderr, "Shared memory %s is not ours\n", name.Data());
+         return(false);
+      }
+      return(true);
+   };
+
+   //--------------------------------------------------------------------------
+   // Start an update and get the data to fill (writer only)
+   LiveData *Begin() {
+      data->sequence.fetch_add(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      return(data);
+   };
+
+   //--------------------------------------------------------------------------
+   // Finish an update (writer only)
+   void End() {
+      data->sequence.fetch_add(1, std::memory_order_release);
+   };
+
+   //--------------------------------------------------------------------------
+   // Copy a consistent snapshot of the data (reader only). Returns false if
+   // we couldn't get one, because the writer kept updating it.
+   bool Read(LiveData *copy) {
+      for (int attempt = 0; attempt < 1000; attempt++) {
+         uint64_t s1 = data->sequence.load(std::memory_order_acquire);
+         if (s1 & 1) {
+            usleep(100);
+            continue;
+         }
+         memcpy((void *)copy, (const void *)data, sizeof(LiveData));
+         std::atomic_thread_fence(std::memory_order_acquire);
+         uint64_t s2 = data->sequence.load(std::memory_order_relaxed);
+         if (s1 == s2) return(true);
+      }
+      return(false);
+   };
+};
+
+#endif
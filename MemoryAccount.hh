@@ -0,0 +1,199 @@
+// Class to account for the memory used by each subsystem on each thread, so we
+// know what a worker costs when we run with many threads. The parts of the
+// simulation which allocate memory (the level scheme, the acceptance map, the
+// event contexts, the blocks of cascades, the sensitive detectors and the
+// pools of blocks of the output and the input) report the bytes they hold to
+// the table of the calling thread. The tables are created by each thread the
+// first time it reports, just like the event contexts, so reporting only
+// touches memory of that thread.
+//
+// Geant4 itself (the worker run managers, the per-thread copies of the
+// processes and the navigators) can't be accounted for like this, so we also
+// take snapshots of the resident set size of the process. The growth during
+// the initialisation of the run manager, which is when the workers set
+// themselves up, less what the workers reported during it, is the cost of
+// the Geant4 state of the workers. What the workers report later (e.g.
+// buffers which grow during the run) isn't part of that growth, so each
+// snapshot also records the bytes the workers had reported by then.
+//
+// Read-only data (level scheme, acceptance map, detector response and
+// configuration) is created on the master and shared by all the workers, so
+// it appears once, in the row of the master.
+
+#ifndef __MEMORY_ACCOUNT_HH__
+#define __MEMORY_ACCOUNT_HH__
+
+#include <G4Threading.hh>
+#include <G4AutoLock.hh>
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+
+//-----------------------------------------------------------------------------
+// Subsystems we account for
+enum MemorySubsystem {
+   kMemoryLevels,     // Level scheme
+   kMemoryAcceptance, // Acceptance map
+   kMemoryContext,    // Event context (Datum and detector sums)
+   kMemoryCascades,   // Blocks of pre-generated cascades
+   kMemoryDetectors,  // Sensitive detectors (deposits for the time pickoff)
+   kMemoryOutput,     // Pool of blocks of events for the output
+   kMemoryInput,      // Pool of blocks of primary events read from a file
+   kNMemory
+};
+
+//-----------------------------------------------------------------------------
+// Class for the memory accounting
+class MemoryAccount {
+
+ private:
+   long bytes[kNMemory];              // Bytes held by each subsystem
+   int thread;                        // Thread ID (-1 = master)
+
+   static G4ThreadLocal MemoryAccount *account; // Table of this thread
+   static std::vector <MemoryAccount *> accounts; // All the tables
+   static std::vector <const char *> labels; // Labels of the snapshots
+   static std::vector <double> rss;   // Resident set size at the snapshots
+   static std::vector <long> marked;  // Bytes of the workers at the snapshots
+   static G4Mutex mutex;              // Lock for the lists
+
+   //--------------------------------------------------------------------------
+   // Constructor - private, use Get() instead
+   MemoryAccount() {
+      thread = G4Threading::G4GetThreadId();
+      memset(bytes, 0, sizeof(bytes));
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the table of the calling thread, creating it if necessary
+   static MemoryAccount *Get() {
+      if (account) return(account);
+      account = new MemoryAccount();
+      G4AutoLock l(&mutex);
+      accounts.push_back(account);
+      return(account);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the sum of the bytes of a table
+   long GetTotal() const {
+      long total = 0;
+      for (int i = 0; i < kNMemory; i++) total += bytes[i];
+      return(total);
+   };
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Add to (or with a negative number, take from) the bytes held by a
+   // subsystem on the calling thread
+   static void Add(MemorySubsystem subsystem, long n) {
+      Get()->bytes[subsystem] += n;
+   };
+
+   //--------------------------------------------------------------------------
+   // Update the bytes held by an object of a subsystem on the calling
+   // thread. The object keeps what it reported last time in reported, so
+   // it can call this whenever its buffers may have grown.
+   static void Update(MemorySubsystem subsystem, long &reported, long n) {
+      if (n == reported) return;
+      Add(subsystem, n - reported);
+      reported = n;
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the resident set size of the process in bytes
+   static double GetRSS() {
+      long size = 0, resident = 0;
+      FILE *fp = fopen("/proc/self/statm", "r");
+      if (!fp) return(0);
+      if (fscanf(fp, "%ld%ld", &size, &resident) != 2) resident = 0;
+      fclose(fp);
+      return((double)resident * sysconf(_SC_PAGESIZE));
+   };
+
+   //--------------------------------------------------------------------------
+   // Take a snapshot of the resident set size and of the bytes the workers
+   // have reported with a label
+   static void Mark(const char *label) {
+      G4AutoLock l(&mutex);
+      long workers = 0;  // Bytes the workers reported in between
+      for (unsigned int i = 0; i < accounts.size(); i++)
+        if (accounts[i]->thread >= 0) workers += accounts[i]->GetTotal();
+      labels.push_back(label);
+      rss.push_back(GetRSS());
+      marked.push_back(workers);
+   };
+
+   //--------------------------------------------------------------------------
+   // Show the memory of each subsystem on each thread and the snapshots of
+   // the resident set size. The growth between the snapshots labelled
+   // "before initialisation" and "after initialisation", less what the
+   // workers reported in between, is shared between the nthreads workers
+   // for the Geant4 state.
+   static void Show(unsigned int nthreads) {
+      const char *names[kNMemory] = {"levels", "acceptance", "context",
+                                     "cascades", "detectors", "output",
+                                     "input"};
+      const double MB = 1024. * 1024.;
+      G4AutoLock l(&mutex);
+
+      // The subsystems on each thread
+      printf("Memory in MB:\n%-8s", "thread");
+      for (int i = 0; i < kNMemory; i++) printf(" %10s", names[i]);
+      printf(" %10s\n", "total");
+      long sum[kNMemory + 1];
+      memset(sum, 0, sizeof(sum));
+      for (unsigned int j = 0; j < accounts.size(); j++) {
+         const MemoryAccount *a = accounts[j];
+         long total = a->GetTotal();
+         if (!total) continue;
+         if (a->thread < 0) printf("%-8s", "master");
+         else printf("%-8d", a->thread);
+         for (int i = 0; i < kNMemory; i++) {
+            printf(" %10.3f", a->bytes[i] / MB);
+            sum[i] += a->bytes[i];
+         }
+         printf(" %10.3f\n", total / MB);
+         sum[kNMemory] += total;
+      }
+      printf("%-8s", "all");
+      for (int i = 0; i <= kNMemory; i++) printf(" %10.3f", sum[i] / MB);
+      printf("\n");
+
+      // The snapshots of the resident set size
+      double before = -1, after = -1;
+      long workers = 0;  // Bytes the workers reported in between
+      for (unsigned int i = 0; i < rss.size(); i++) {
+         printf("Resident set size %-24s %10.1f MB\n", labels[i], rss[i] / MB);
+         if (!strcmp(labels[i], "before initialisation")) {
+            before = rss[i];
+            workers -= marked[i];
+         }
+         if (!strcmp(labels[i], "after initialisation")) {
+            after = rss[i];
+            workers += marked[i];
+         }
+      }
+      if (before >= 0 && after >= 0 && nthreads > 0)
+        printf("Geant4 state per worker (estimated) %10.1f MB\n",
+               (after - before - workers) / nthreads / MB);
+   };
+
+   //--------------------------------------------------------------------------
+   // Delete all the tables. No thread may report after this.
+   static void DeleteAll() {
+      G4AutoLock l(&mutex);
+      for (unsigned int i = 0; i < accounts.size(); i++) delete accounts[i];
+      accounts.clear();
+   };
+};
+G4ThreadLocal MemoryAccount *MemoryAccount::account = NULL;
+std::vector <MemoryAccount *> MemoryAccount::accounts;
+std::vector <const char *> MemoryAccount::labels;
+std::vector <double> MemoryAccount::rss;
+std::vector <long> MemoryAccount::marked;
+G4Mutex MemoryAccount::mutex = G4MUTEX_INITIALIZER;
+#endif
@@ -0,0 +1,173 @@
+// Counter-based random number engine (Philox4x32-10, Salmon et al., SC11).
+// Unlike the usual engines, it has no state to warm up: each output is a
+// function of a key and a counter only. We use the run seed as the key and
+// put the run and event numbers in the counter, so that the random numbers of
+// any event can be regenerated directly from (seed, run, event) without
+// running the events before it. Setting a new stream is just a few
+// assignments, so we can afford to do it for every event.
+
+#ifndef __PHILOX_ENGINE_HH__
+#define __PHILOX_ENGINE_HH__
+
+#include <Randomize.hh>
+
+#include <cstdio>
+#include <stdint.h>
+#include <iostream>
+#include <string>
+
+//-----------------------------------------------------------------------------
+// Class for the Philox4x32-10 engine
+class PhiloxEngine : public CLHEP::HepRandomEngine {
+
+ private:
+   uint32_t key[2];     // Key (from the seed)
+   uint32_t counter[4]; // Counter: 0,1 = draw number, 2 = event, 3 = run
+   uint32_t output[4];  // Output of the last block
+   int index;           // Index of next output word to use
+
+   //--------------------------------------------------------------------------
+   // Multiply two 32-bit numbers and return the high and low words
+   static inline void MulHiLo(uint32_t a, uint32_t b, uint32_t &hi,
+                              uint32_t &lo) {
+      uint64_t product = (uint64_t)a * (uint64_t)b;
+      hi = (uint32_t)(product >> 32);
+      lo = (uint32_t)product;
+   };
+
+   //--------------------------------------------------------------------------
+   // Generate the next block of four 32-bit words and increment the counter
+   void Generate() {
+      uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2];
+      uint32_t c3 = counter[3], k0 = key[0], k1 = key[1];
+      for (int round = 0; round < 10; round++) {
+         uint32_t hi0, lo0, hi1, lo1;
+         MulHiLo(0xD2511F53, c0, hi0, lo0);
+         MulHiLo(0xCD9E8D57, c2, hi1, lo1);
+         c0 = hi1 ^ c1 ^ k0;
+         c1 = lo1;
+         c2 = hi0 ^ c3 ^ k1;
+         c3 = lo0;
+         k0 += 0x9E3779B9;
+         k1 += 0xBB67AE85;
+      }
+      output[0] = c0;
+      output[1] = c1;
+      output[2] = c2;
+      output[3] = c3;
+      index = 0;
+      if (++counter[0] == 0) counter[1]++;
+   };
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Constructor
+   PhiloxEngine(long seed = 19780503) {
+      setSeed(seed, 0);
+   };
+
+   //--------------------------------------------------------------------------
+   // Select the stream for a given seed, run and event. The draw counter
+   // starts again from zero.
+   void SetStream(uint64_t seed, uint32_t run, uint32_t event) {
+      key[0] = (uint32_t)seed;
+      key[1] = (uint32_t)(seed >> 32);
+      counter[0] = counter[1] = 0;
+      counter[2] = event;
+      counter[3] = run;
+      index = 4;
+   };
+
+   //--------------------------------------------------------------------------
+   // Get a flat random number in the open interval (0,1) with 53 bits
+   double flat() {
+      if (index > 2) Generate();
+      uint64_t bits = ((uint64_t)output[index] << 32) | output[index + 1];
+      index += 2;
+      return(((double)(bits >> 11) + 0.5) * (1.0 / 9007199254740992.0));
+   };
+
+   //--------------------------------------------------------------------------
+   // Fill an array with flat random numbers
+   void flatArray(const int size, double *vect) {
+      for (int i = 0; i < size; i++) vect[i] = flat();
+   };
+
+   //--------------------------------------------------------------------------
+   // Set the seed (the key), starting at the beginning of stream 0, 0
+   void setSeed(long seed, int) {
+      theSeed = seed;
+      SetStream((uint64_t)seed, 0, 0);
+   };
+
+   //--------------------------------------------------------------------------
+   // Set the seeds - Geant4 gives two per event in multithreaded mode, which
+   // we combine into the key. The list is terminated by a zero.
+   void setSeeds(const long *seeds, int) {
+      theSeeds = seeds;
+      uint64_t seed = (uint64_t)seeds[0];
+      if (seeds[0] && seeds[1]) seed ^= (uint64_t)seeds[1] << 32;
+      theSeed = seeds[0];
+      SetStream(seed, 0, 0);
+   };
+
+   //--------------------------------------------------------------------------
+   // Write the state to the stream
+   std::ostream &put(std::ostream &os) const {
+      os << name() << "-begin";
+      for (int i = 0; i < 2; i++) os << " " << key[i];
+      for (int i = 0; i < 4; i++) os << " " << counter[i];
+      for (int i = 0; i < 4; i++) os << " " << output[i];
+      os << " " << index << " " << name() << "-end\n";
+      return(os);
+   };
+
+   //--------------------------------------------------------------------------
+   // Read the state from the stream
+   std::istream &get(std::istream &is) {
+      std::string tag;
+      is >> tag;
+      for (int i = 0; i < 2; i++) is >> key[i];
+      for (int i = 0; i < 4; i++) is >> counter[i];
+      for (int i = 0; i < 4; i++) is >> output[i];
+      is >> index >> tag;
+      return(is);
+   };
+
+   //--------------------------------------------------------------------------
+   // Save the state to a file
+   void saveStatus(const char filename[] = "Philox.conf") const {
+      FILE *fp = fopen(filename, "w");
+      if (!fp) return;
+      fprintf(fp, "%u %u %u %u %u %u\n", key[0], key[1], counter[0],
+              counter[1], counter[2], counter[3]);
+      fclose(fp);
+   };
+
+   //--------------------------------------------------------------------------
+   // Restore the state from a file. We start at the beginning of the block
+   // given by the counter.
+   void restoreStatus(const char filename[] = "Philox.conf") {
+      FILE *fp = fopen(filename, "r");
+      if (!fp) return;
+      if (fscanf(fp, "%u%u%u%u%u%u", &key[0], &key[1], &counter[0],
+                 &counter[1], &counter[2], &counter[3]) == 6) index = 4;
+      fclose(fp);
+   };
+
+   //--------------------------------------------------------------------------
+   // Show the state
+   void showStatus() const {
+      printf("PhiloxEngine: key = %08x%08x run = %u event = %u draw = %u\n",
+             key[1], key[0], counter[3], counter[2], counter[0]);
+   };
+
+   //--------------------------------------------------------------------------
+   // Name of the engine
+   std::string name() const {
+      return("PhiloxEngine");
+   };
+};
+
+#endif
@@ -1,21 +1,71 @@
+// Physics list - just the standard EM option4 physics. Optionally, the EM
+// processes of the gamma are wrapped so that their mean free paths at the
+// energies of the level scheme are cached (see CachedProcess.hh). For
+// splitting (see SplittingOperator.hh), the generic biasing physics gives the
+// gamma the process through which the biasing operators act.
+
 #ifndef __PHYSICS_LIST_HH__
 #define __PHYSICS_LIST_HH__
 
 #include <G4VModularPhysicsList.hh>
 #include <G4EmStandardPhysics_option4.hh>
 #include <G4SystemOfUnits.hh>
+#include <G4Gamma.hh>
+#include <G4ProcessManager.hh>
+#include <G4ProcessVector.hh>
+#include <G4VEmProcess.hh>
+#include <G4GenericBiasingPhysics.hh>
+
+#include <vector>
+
+#include "CachedProcess.hh"
 
 class PhysicsList : public G4VModularPhysicsList {
+
+ private:
+   const std::vector <double> *energies; // Energies to cache (NULL = none)
+   bool biasing; // Do we split gammas?
    
  public:
 
    // In the constructor, we register 
-   PhysicsList() : G4VModularPhysicsList() {
+   PhysicsList(const std::vector <double> *energies_ = NULL,
+               bool biasing_ = false) :
+     G4VModularPhysicsList() {
       defaultCutValue = 1.0*mm;
       SetVerboseLevel(1);
+      energies = energies_;
+      biasing = biasing_;
 
       // Register the Em standard physics option4
       RegisterPhysics(new G4EmStandardPhysics_option4());
+
+      // Register the generic biasing for the gamma, only for the biasing
+      // which isn't of a physics process
+      if (biasing) {
+         G4GenericBiasingPhysics *generic = new G4GenericBiasingPhysics();
+         generic->NonPhysicsBias("gamma");
+         RegisterPhysics(generic);
+      }
+   };
+
+   // Construct the processes (on each thread) and, if we have energies to
+   // cache, replace the EM processes of the gamma by wrappers with a cache
+   virtual void ConstructProcess() {
+      G4VModularPhysicsList::ConstructProcess();
+      if (!energies || energies->empty()) return;
+      G4ProcessManager *manager = G4Gamma::Gamma()->GetProcessManager();
+      G4ProcessVector *list = manager->GetProcessList();
+      std::vector <G4VEmProcess *> processes;
+      for (G4int i = 0; i < (G4int)list->size(); i++) {
+         G4VEmProcess *process = dynamic_cast <G4VEmProcess *> ((*list)[i]);
+         if (process) processes.push_back(process);
+      }
+      for (unsigned int i = 0; i < processes.size(); i++) {
+         manager->RemoveProcess(processes[i]);
+         manager->AddDiscreteProcess(new CachedProcess(processes[i],
+                                                       *energies));
+      }
    };
 
    // The cuts are just set in the default way, using the parent class
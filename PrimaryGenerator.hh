@@ -9,109 +9,228 @@
 #define __PRIMARY_GENERATOR_HH__
 
 #include <G4VUserPrimaryGeneratorAction.hh>
-#include <G4ParticleGun.hh>
+#include <G4PrimaryVertex.hh>
+#include <G4PrimaryParticle.hh>
+#include <G4Event.hh>
 #include <G4Gamma.hh>
-#include <G4MTRandExponential.hh>
+#include <G4ParticleTable.hh>
+#include <G4RunManager.hh>
+#include <G4Run.hh>
 #include <G4SystemOfUnits.hh>
 
+#include <cmath>
+
 #include "LevelScheme.hh"
+#include "CascadeBlock.hh"
+#include "EventContext.hh"
+#include "RandomSetup.hh"
+#include "AcceptanceMap.hh"
+#include "EventInput.hh"
 
 //-----------------------------------------------------------------------------
-// This is a simple class to use the G4ParticleGun to generate the gammas.
+// This is a simple class to generate the gammas. The cascades are generated
+// in blocks (see CascadeBlock.hh) and for each event we just take the next
+// one and create the primary vertices directly, rather than setting up a
+// particle gun for each gamma. If per-event random number streams are used,
+// the block only holds one cascade, which is generated from the stream of the
+// event, so that it doesn't depend on which thread generated it.
+//
+// For time-ordered listmode, each thread is a source with a given decay rate
+// and each decay starts an exponentially distributed time after the previous
+// one of the thread. The start is kept as an integer number of ps in the
+// event context, while the gammas are still generated from time zero, so
+// the times within the event keep their precision. As the sum of independent
+// sources is a source with the sum of the rates, the merged threads have the
+// activity of the whole source.
+//
+// The level scheme is read once on the master and shared by all the
+// threads, so we only keep a pointer to it.
+//
+// If we are given an acceptance map (see AcceptanceMap.hh), we don't create
+// the gammas which can't reach any detector, but count them in the event
+// context for the normalisation. If none of the gammas of a cascade can reach
+// a detector, the event has no primaries at all, so Geant4 has nothing to
+// track and the event is written with no hits, just as it would have been.
+//
+// With stratified sampling, each cascade has a weight, which we put in the
+// event context for the output.
+//
+// If we are given an input file (see EventInput.hh), we take the events from
+// its blocks instead of the level scheme, with whatever particles they have.
+// The acceptance map is only used for the gammas, as the other particles
+// don't go in straight lines. When the file is used up, we abort the event
+// and the run.
+//
+// If we tag the deposits (see SensitiveDetector.hh), we give the event
+// context the transition and the energy of each primary we create, in order.
+// The particles of an input file have no transition, so only their energies
+// are known.
 class PrimaryGenerator : public G4VUserPrimaryGeneratorAction {
 
  private:
-   G4ParticleGun gun; // An instance of the particle gun
-   LevelScheme ls;    // The level scheme to generate
+   const LevelScheme *ls; // The level scheme to generate (shared)
+   const RandomSetup *random; // Random number setup
+   CascadeBlock block;  // Block of pre-generated cascades
+   G4ParticleDefinition *gamma; // Gamma definition
+   double rate;         // Decay rate of this thread in Bq (0 = no listmode)
+   const AcceptanceMap *acceptance; // Directions which can reach a detector
+                                    // (NULL = generate all the gammas)
+   EventInput *input;   // Input file (NULL = use the level scheme)
+   InputBlock *current; // Block of the input we are using
+   std::vector <int> pdgs; // PDG codes we have looked up
+   std::vector <G4ParticleDefinition *> particles; // ... and their particles
+   bool tagging;        // Do we tag the deposits with the primaries?
 
    //--------------------------------------------------------------------------
-   // Generate a single gamma ray of a given energy in a random direction from
-   // the origin
-   void GenerateGamma(G4Event *event, G4double E) {
-      
-      // Set it to fire gammas
-      gun.SetParticleDefinition(G4Gamma::GammaDefinition());
-
-      // Set the energy
-      gun.SetParticleEnergy(E);
-      
-      // Set the initial position (the origin)
-      gun.SetParticlePosition(G4ThreeVector(0,0,0));
-      
-      // Pick a random isotropically distributed direction i.e. linear in
-      // cos(theta) and linear in phi
-      G4double cosTheta = 2 * G4UniformRand() - 1;
-      G4double phi = CLHEP::twopi * G4UniformRand();
-      G4ThreeVector direction(0,0,1);
-      direction.setTheta(std::acos(cosTheta));
-      direction.setPhi(phi);
-      gun.SetParticleMomentumDirection(direction);
-                                       
-      // Fire the gun
-      gun.GeneratePrimaryVertex(event);
+   // Generate a single particle (a gamma ray unless we are given another
+   // definition) of a given energy in a given direction from the origin at a
+   // given time
+   void GenerateParticle(G4Event *event, G4double E, const G4ThreeVector &dir,
+                         G4double t, G4ParticleDefinition *definition = NULL) {
+      G4PrimaryParticle *particle =
+        new G4PrimaryParticle(definition ? definition : gamma);
+      particle->SetKineticEnergy(E);
+      particle->SetMomentumDirection(dir);
+      G4PrimaryVertex *vertex = new G4PrimaryVertex(G4ThreeVector(0,0,0), t);
+      vertex->SetPrimary(particle);
+      event->AddPrimaryVertex(vertex);
    };
 
    //--------------------------------------------------------------------------
-   // Increase the global time to allow for lifetime in between states
-   void AddTime(G4double tau) {
+   // Get the particle of a PDG code (NULL if unknown), remembering the few
+   // we have seen
+   G4ParticleDefinition *GetParticle(int pdg) {
+      for (unsigned int i = 0; i < pdgs.size(); i++)
+        if (pdgs[i] == pdg) return(particles[i]);
+      G4ParticleDefinition *particle =
+        G4ParticleTable::GetParticleTable()->FindParticle(pdg);
+      if (!particle)
+        fprintf(stderr, "Unknown particle %d in the input skipped\n", pdg);
+      pdgs.push_back(pdg);
+      particles.push_back(particle);
+      return(particle);
+   };
 
-      // Get previous time
-      G4double t = gun.GetParticleTime();
+   //--------------------------------------------------------------------------
+   // Generate the vertices of the next event of the input file
+   void GenerateInput(G4Event *event, EventContext *context) {
 
-      // Add a random decay time weighted exponentially
-      t += G4RandExponential::shoot(tau);
+      // Get a new block if we have used up the one we had
+      if (current && current->IsEmpty()) {
+         input->Release(current);
+         current = NULL;
+      }
+      if (!current) current = input->GetFullBlock();
+      if (!current) {
+         event->SetEventAborted();
+         G4RunManager::GetRunManager()->AbortRun(true);
+         return;
+      }
 
-      // Set new time
-      gun.SetParticleTime(t);
+      // The events of the file have no weight of their own (the roulette of
+      // the splitting may still change it)
+      context->SetWeight(1);
+
+      // Generate its particles, skipping the gammas which can't reach a
+      // detector
+      const InputVertex *v;
+      unsigned int n = current->Pop(v), nskipped = 0;
+      for (unsigned int i = 0; i < n; i++) {
+         G4ParticleDefinition *particle = GetParticle(v[i].pdg);
+         if (!particle) continue;
+         G4ThreeVector dir(v[i].dx, v[i].dy, v[i].dz);
+         if (acceptance && particle == gamma &&
+             !acceptance->IsReachable(dir)) {
+            nskipped++;
+            continue;
+         }
+         GenerateParticle(event, v[i].energy * keV, dir, v[i].time * ps,
+                          particle);
+         if (tagging) context->AddPrimary(0, v[i].energy);
+      }
+      if (nskipped) {
+         context->CountSkipped(nskipped);
+         if (nskipped == n) context->CountEmpty();
+      }
    };
-   
+
  public:
 
    //--------------------------------------------------------------------------
-   // Constructor
-   PrimaryGenerator(const char *filename) {
-
-      // Read the level scheme
-      ls.Read(filename);
+   // Constructor - rate is the decay rate of this thread in Bq for
+   // time-ordered listmode and acceptance is the map of the directions which
+   // can reach a detector, if we should skip the others. If we are given an
+   // input file, the events come from it instead of the level scheme.
+   PrimaryGenerator(const LevelScheme *ls_, const RandomSetup *random_,
+                    double rate_ = 0, const AcceptanceMap *acceptance_ = NULL,
+                    EventInput *input_ = NULL) :
+     ls(ls_), random(random_),
+     block(random_->GetStreams() ? 1 : kCascadeBlockSize),
+     rate(rate_), acceptance(acceptance_), input(input_), current(NULL) {
+      gamma = G4Gamma::GammaDefinition();
+      tagging = EventContext::GetTagging();
+   };
 
-      // Show it
-      ls.Show();
+   //--------------------------------------------------------------------------
+   // Destructor - give back the block of the input we were using
+   ~PrimaryGenerator() {
+      if (current) input->Release(current);
    };
    
    //--------------------------------------------------------------------------
-   // Generate primaries - three gammas, all isotropic and directionally
-   // uncorrelated with each other, with levels of specified lifetimes in
-   // between
+   // Generate primaries - the gammas of the next cascade, all isotropic and
+   // directionally uncorrelated with each other, with levels of specified
+   // lifetimes in between. The absolute time starts at zero for each event.
    void GeneratePrimaries(G4Event *event) {
 
-      // Initialise the absolute time to zero
-      gun.SetParticleTime(0);
-
-      // Pick an initial level at random weighted by the population
-      Level *level = ls.PickPrimaryLevel();
-      while (level) {
-
-         // Get the tau of the level
-         double tau = level->GetTau();
-         if (tau < 0) break; // negative means stable
-
-         // Pick a depopulating transition
-         Transition *transition = level->PickDepopulatingTransition();
-         if (!transition) break; // NULL means no depopulating transition
+      // Select the stream of this event and generate its cascade
+      EventContext *context = EventContext::Get();
+      if (tagging) context->ClearPrimaries();
+      if (random->GetStreams()) {
+         G4RunManager *run_manager = G4RunManager::GetRunManager();
+         const G4Run *run = run_manager ? run_manager->GetCurrentRun() : NULL;
+         random->SetStream(context->GetEngine(),
+                           run ? run->GetRunID() : 0, event->GetEventID());
+         if (!input) block.Fill(*ls);
+      }
 
-         // Get the gamma energy for that transition
-         double Egamma = transition->GetEnergy();
+      // Start time of the decay in ps
+      if (rate > 0) {
+         double u = context->GetEngine()->flat();
+         context->SetStart(context->GetStart() +
+                           llround(-log(1. - u) / rate * 1e12));
+      }
 
-         // Generate the gamma
-         GenerateGamma(event, Egamma);
-         
-         // Get level which it populates
-         level = transition->GetFinal();
-         tau = level->GetTau();
-         if (tau < 0) break; // negative means stable
+      // Take the event from the input file if we have one
+      if (input) {
+         GenerateInput(event, context);
+         return;
+      }
 
-         // Allow for lifetime in between
-         AddTime(tau);
+      // Generate a new block of cascades if we have used them all
+      if (block.IsEmpty()) block.Fill(*ls);
+
+      // Generate the gammas of the next cascade, skipping those which can't
+      // reach a detector
+      unsigned int index;
+      unsigned int n = block.Pop(index), nskipped = 0;
+      context->SetWeight(block.GetWeight());
+      for (unsigned int i = index; i < index + n; i++) {
+         G4ThreeVector dir = block.GetDirection(i);
+         if (acceptance && !acceptance->IsReachable(dir)) {
+            nskipped++;
+            continue;
+         }
+         GenerateParticle(event, block.GetEnergy(i), dir, block.GetTime(i));
+         if (tagging) {
+            unsigned int line = block.GetLine(i) + 1;
+            context->AddPrimary((line <= kTagLine) ? line : 0,
+                                block.GetEnergy(i) / keV);
+         }
+      }
+      if (nskipped) {
+         context->CountSkipped(nskipped);
+         if (nskipped == n) context->CountEmpty();
       }
    };
 };
@@ -0,0 +1,181 @@
+// Class to choose the random number engine at run time and to give each
+// event its own stream of random numbers. The engine is specified as a name,
+// optionally followed by a colon and the luxury level:
+//
+// mixmax        CLHEP MixMax (the Geant4 default)
+// ranlux[:LUX]  CLHEP Ranlux, luxury 0-4 (default 3, which we used to force)
+// ranlux64[:LUX] CLHEP Ranlux64, luxury 0-2 (default 1)
+// ranecu        CLHEP Ranecu
+// mtwist        CLHEP Mersenne twister
+// philox        counter-based Philox4x32-10 (see PhiloxEngine.hh)
+//
+// If per-event streams are turned on, the engine of each thread is reseeded
+// at the start of every event from (seed, run, event), so any event can be
+// regenerated on its own and a run can be split into pieces, which give the
+// same events as the whole run. For the philox engine this costs almost
+// nothing, but the others have to be reseeded, which for Ranlux is slow.
+//
+// Geant4 can't clone an engine type it doesn't know for the worker threads,
+// so we also provide the worker thread initialisation, which creates the
+// engine we want for each worker.
+
+#ifndef __RANDOM_SETUP_HH__
+#define __RANDOM_SETUP_HH__
+
+#include <G4UserWorkerThreadInitialization.hh>
+#include <Randomize.hh>
+
+#include <TString.h>
+
+#include <cstdio>
+#include <stdint.h>
+
+#include "PhiloxEngine.hh"
+
+//-----------------------------------------------------------------------------
+// Class for the random number setup
+class RandomSetup {
+
+ private:
+   TString type;    // Engine type
+   int luxury;      // Luxury level (Ranlux only)
+   long seed;       // Run seed
+   bool streams;    // Reseed for every event?
+
+   //--------------------------------------------------------------------------
+   // Mix a 64-bit value (splitmix64 finaliser) to derive seeds
+   static uint64_t Mix(uint64_t x) {
+      x += 0x9E3779B97F4A7C15ULL;
+      x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+      return(x ^ (x >> 31));
+   };
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Constructor
+   RandomSetup() {
+      type = "ranlux";
+      luxury = 3;
+      seed = 0;
+      streams = false;
+   };
+
+   //--------------------------------------------------------------------------
+   // Set the engine type from a string like "ranlux:4". Returns false if we
+   // don't know the engine.
+   bool SetEngine(const char *spec) {
+      TString s(spec);
+      int colon = s.Index(":");
+      type = (colon < 0) ? s : TString(s(0, colon));
+      type.ToLower();
+      if (type == "ranlux") luxury = 3;
+      else if (type == "ranlux64") luxury = 1;
+      else luxury = 0;
+      if (colon >= 0) luxury = TString(s(colon + 1, s.Length())).Atoi();
+      if (type == "mixmax" || type == "ranecu" || type == "mtwist" ||
+          type == "philox") return(true);
+      if (type == "ranlux" && luxury >= 0 && luxury <= 4) return(true);
+      if (type == "ranlux64" && luxury >= 0 && luxury <= 2) return(true);
+      fprintf(stderr, "Unknown random number engine %s\n", spec);
+      return(false);
+   };
+
+   //--------------------------------------------------------------------------
+   // Set the run seed
+   void SetSeed(long seed_) {
+      seed = seed_;
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the run seed
+   long GetSeed() const {
+      return(seed);
+   };
+
+   //--------------------------------------------------------------------------
+   // Turn per-event streams on or off
+   void SetStreams(bool streams_) {
+      streams = streams_;
+   };
+
+   //--------------------------------------------------------------------------
+   // Are we using per-event streams?
+   bool GetStreams() const {
+      return(streams);
+   };
+
+   //--------------------------------------------------------------------------
+   // Create a new engine of the type we want
+   CLHEP::HepRandomEngine *Create() const {
+      if (type == "mixmax") return(new CLHEP::MixMaxRng());
+      if (type == "ranlux64") return(new CLHEP::Ranlux64Engine(seed, luxury));
+      if (type == "ranecu") return(new CLHEP::RanecuEngine());
+      if (type == "mtwist") return(new CLHEP::MTwistEngine());
+      if (type == "philox") return(new PhiloxEngine(seed));
+      return(new CLHEP::RanluxEngine(seed, luxury));
+   };
+
+   //--------------------------------------------------------------------------
+   // Create the engine for the master thread and seed it
+   void Initialise() {
+      G4Random::setTheEngine(Create());
+      G4Random::setTheSeed(seed, luxury);
+      G4Random::showEngineStatus();
+   };
+
+   //--------------------------------------------------------------------------
+   // Select the stream for a given run and event on an engine
+   void SetStream(CLHEP::HepRandomEngine *engine, int run, int event) const {
+
+      // The counter-based engine just takes the stream
+      PhiloxEngine *philox = dynamic_cast <PhiloxEngine *> (engine);
+      if (philox) {
+         philox->SetStream((uint64_t)seed, run, event);
+         return;
+      }
+
+      // The others are reseeded with seeds derived from the stream (positive
+      // and the list terminated by zero, as CLHEP wants)
+      uint64_t stream = ((uint64_t)run << 32) | (uint32_t)event;
+      uint64_t h = Mix(Mix((uint64_t)seed) ^ stream);
+      long seeds[3];
+      seeds[0] = (long)(h & 0x7FFFFFFF) + 1;
+      seeds[1] = (long)((h >> 32) & 0x7FFFFFFF) + 1;
+      seeds[2] = 0;
+      engine->setSeeds(seeds, luxury);
+   };
+
+   //--------------------------------------------------------------------------
+   // Show the settings
+   void Show() {
+      printf("Random: engine = %s luxury = %d seed = %ld per-event streams = %s\n",
+             type.Data(), luxury, seed, streams ? "on" : "off");
+   };
+};
+
+//-----------------------------------------------------------------------------
+// Worker thread initialisation, which gives each worker thread an engine of
+// the type we want. Everything else is done by the Geant4 base class.
+class WorkerInitialization : public G4UserWorkerThreadInitialization {
+
+ private:
+   const RandomSetup *random; // Random number setup
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Constructor
+   WorkerInitialization(const RandomSetup *random_) {
+      random = random_;
+   };
+
+   //--------------------------------------------------------------------------
+   // Create the engine for the worker. Geant4 seeds it afterwards.
+   void SetupRNGEngine(const CLHEP::HepRandomEngine *) const {
+      G4Random::setTheEngine(random->Create());
+   };
+};
+
+#endif
@@ -0,0 +1,286 @@
+// Class to describe the layout of an event record: the number of detectors,
+// the values stored for each (energy and time, or energy, time and the x, y
+// and z position) and whether they are stored as double or float. The
+// sensitive detectors store into a Datum of doubles and the records are
+// packed into the blocks of the output (see EventBlock.hh) and written to the
+// tree in the precision of the layout, so a float layout halves the blocks
+// and the tree and dropping the position takes them down to 2/5.
+//
+// The operations on a whole record (reset, pack into a block and unpack from
+// it) are templates on the value type, the number of detectors and the
+// number of values per detector, so for the common numbers of detectors (1
+// to 8) the loop counts are constants, the copies and resets are unrolled
+// and there are no bounds checks. Any other number of detectors uses the
+// version with NDET = 0, which takes the number of detectors at run time. The
+// layout picks the versions once and keeps pointers to them, so a record
+// costs one call per operation. Storing the values of one detector doesn't
+// depend on the number of detectors, so the layout does it inline.
+//
+// The layout is given as FIELDS[:PRECISION][:tags], with FIELDS et or etxyz
+// and PRECISION double or float, e.g. et:float (default etxyz:double).
+//
+// With tags, each record also has a 16-bit tag for each detector after the
+// values, which says where its deposit came from (see SensitiveDetector.hh):
+// the number of the transition of the level scheme whose gamma left the most
+// energy (1 for the first transition read, 0 for none), whether that gamma
+// was fully absorbed in the detector or scattered and whether any other
+// primary left energy there too. So one run can be split into the
+// components of each line in the analysis (see analyse.cc).
+
+#ifndef __RECORD_LAYOUT_HH__
+#define __RECORD_LAYOUT_HH__
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+//-----------------------------------------------------------------------------
+// Bits of the tag of a detector
+enum {
+   kTagLine  = 0x3fff, // Number of the transition (0 = none or not known)
+   kTagFull  = 0x4000, // Its gamma was fully absorbed in the detector
+   kTagMixed = 0x8000  // Other primaries left energy in the detector too
+};
+
+//-----------------------------------------------------------------------------
+// Operations on a record of NDET detectors (0 = given at run time) with
+// NPERDET values each (2 or 5), stored in the blocks as T
+template <typename T, unsigned int NDET, unsigned int NPERDET>
+struct RecordOps {
+
+   //--------------------------------------------------------------------------
+   // Number of values in the record
+   static inline unsigned int NValues(unsigned int ndet) {
+      return((NDET ? NDET : ndet) * NPERDET);
+   };
+
+   //--------------------------------------------------------------------------
+   // Zero a Datum
+   static void Reset(double *v, unsigned int ndet) {
+      memset(v, 0, sizeof(double) * NValues(ndet));
+   };
+
+   //--------------------------------------------------------------------------
+   // Pack a Datum into a record of a block
+   static void Pack(const double *v, void *record, unsigned int ndet) {
+      T *r = (T *)record;
+      unsigned int n = NValues(ndet);
+#pragma omp simd
+      for (unsigned int i = 0; i < n; i++) r[i] = (T)v[i];
+   };
+
+   //--------------------------------------------------------------------------
+   // Unpack a record of a block into doubles
+   static void Unpack(const void *record, double *v, unsigned int ndet) {
+      const T *r = (const T *)record;
+      unsigned int n = NValues(ndet);
+#pragma omp simd
+      for (unsigned int i = 0; i < n; i++) v[i] = r[i];
+   };
+};
+
+//-----------------------------------------------------------------------------
+// Class for the layout of an event record
+class RecordLayout {
+
+ private:
+   unsigned int ndet;     // Number of detectors
+   unsigned int nperdet;  // Number of values per detector (2 or 5)
+   bool single;           // Stored as float (rather than double)?
+   bool tagged;           // Do the records have the tags?
+   bool fixed;            // Compiled for this number of detectors?
+
+   // The operations for this layout
+   void (*reset)(double *, unsigned int);
+   void (*pack)(const double *, void *, unsigned int);
+   void (*unpack)(const void *, double *, unsigned int);
+
+   //--------------------------------------------------------------------------
+   // Use the operations of the given template
+   template <class Ops>
+   void Use(bool fixed_) {
+      reset = Ops::Reset;
+      pack = Ops::Pack;
+      unpack = Ops::Unpack;
+      fixed = fixed_;
+   };
+
+   //--------------------------------------------------------------------------
+   // Pick the operations for the number of detectors
+   template <typename T, unsigned int NPERDET>
+   void Select() {
+      switch(ndet) {
+       case 1: Use <RecordOps <T, 1, NPERDET> >(true); break;
+       case 2: Use <RecordOps <T, 2, NPERDET> >(true); break;
+       case 3: Use <RecordOps <T, 3, NPERDET> >(true); break;
+       case 4: Use <RecordOps <T, 4, NPERDET> >(true); break;
+       case 5: Use <RecordOps <T, 5, NPERDET> >(true); break;
+       case 6: Use <RecordOps <T, 6, NPERDET> >(true); break;
+       case 7: Use <RecordOps <T, 7, NPERDET> >(true); break;
+       case 8: Use <RecordOps <T, 8, NPERDET> >(true); break;
+       default: Use <RecordOps <T, 0, NPERDET> >(false); break;
+      }
+   };
+
+   //--------------------------------------------------------------------------
+   // Pick the operations for the whole layout
+   void Setup() {
+      if (single) {
+         if (nperdet > 4) Select <float, 5>();
+         else Select <float, 2>();
+      } else {
+         if (nperdet > 4) Select <double, 5>();
+         else Select <double, 2>();
+      }
+   };
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Constructor - the number of detectors, whether we store the position
+   // and whether we store floats
+   RecordLayout(unsigned int ndet_ = 0, bool position = true,
+                bool single_ = false) {
+      ndet = ndet_;
+      nperdet = position ? 5 : 2;
+      single = single_;
+      tagged = false;
+      Setup();
+   };
+
+   //--------------------------------------------------------------------------
+   // Set the fields, the precision and the tags from a string like
+   // "et:float:tags". Returns false if it can't be understood.
+   bool Configure(const char *spec) {
+      char fields[16], options[2][16];
+      int n = sscanf(spec, "%15[^:]:%15[^:]:%15s", fields, options[0],
+                     options[1]);
+      if (n < 1) return(false);
+      if (!strcmp(fields, "et")) nperdet = 2;
+      else if (!strcmp(fields, "etxyz")) nperdet = 5;
+      else return(false);
+      single = tagged = false;
+      for (int i = 0; i < n - 1; i++) {
+         if (!strcmp(options[i], "float")) single = true;
+         else if (!strcmp(options[i], "tags")) tagged = true;
+         else if (strcmp(options[i], "double")) return(false);
+      }
+      Setup();
+      return(true);
+   };
+
+   //--------------------------------------------------------------------------
+   // Set the number of detectors
+   void SetNDetectors(unsigned int ndet_) {
+      ndet = ndet_;
+      Setup();
+   };
+
+   //--------------------------------------------------------------------------
+   // Show the layout
+   void Show() const {
+      printf("Event record: %u detectors with %s as %s%s (%u bytes, %s)\n",
+             ndet, nperdet > 4 ? "E, T, x, y, z" : "E, T",
+             single ? "float" : "double", tagged ? " and tags" : "",
+             GetSize(),
+             fixed ? "compiled for this number of detectors" :
+             "general layout");
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the number of detectors
+   inline unsigned int GetNDetectors() const {
+      return(ndet);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the number of values per detector
+   inline unsigned int GetNPerDetector() const {
+      return(nperdet);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the number of values per record
+   inline unsigned int GetNValues() const {
+      return(ndet * nperdet);
+   };
+
+   //--------------------------------------------------------------------------
+   // Are the values stored as float?
+   inline bool IsSingle() const {
+      return(single);
+   };
+
+   //--------------------------------------------------------------------------
+   // Do the records have the tags?
+   inline bool IsTagged() const {
+      return(tagged);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the size of the values of a record in bytes
+   inline unsigned int GetValuesSize() const {
+      return(ndet * nperdet * (single ? sizeof(float) : sizeof(double)));
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the size of a record in a block in bytes, which is padded to a
+   // whole number of values, so the values of every record are aligned
+   inline unsigned int GetSize() const {
+      unsigned int size = single ? sizeof(float) : sizeof(double);
+      unsigned int bytes = GetValuesSize() +
+        (tagged ? ndet * sizeof(uint16_t) : 0);
+      return((bytes + size - 1) / size * size);
+   };
+
+   //--------------------------------------------------------------------------
+   // Store the energy, time and position of a detector in a Datum (the
+   // position is dropped if the layout doesn't have it)
+   inline void Store(double *v, unsigned int det, double E, double t,
+                     double x, double y, double z) const {
+      v += det * nperdet;
+      v[0] = E;
+      v[1] = t;
+      if (nperdet > 4) {
+         v[2] = x;
+         v[3] = y;
+         v[4] = z;
+      }
+   };
+
+   //--------------------------------------------------------------------------
+   // Zero a Datum
+   inline void Reset(double *v) const {
+      reset(v, ndet);
+   };
+
+   //--------------------------------------------------------------------------
+   // Pack a Datum into a record
+   inline void Pack(const double *v, void *record) const {
+      pack(v, record, ndet);
+   };
+
+   //--------------------------------------------------------------------------
+   // Unpack a record into doubles
+   inline void Unpack(const void *record, double *v) const {
+      unpack(record, v, ndet);
+   };
+
+   //--------------------------------------------------------------------------
+   // Pack the tags of a Datum into a record, after the values (zero if the
+   // Datum has none)
+   inline void PackTags(const uint16_t *tags, void *record) const {
+      char *r = (char *)record + GetValuesSize();
+      if (tags) memcpy(r, tags, ndet * sizeof(uint16_t));
+      else memset(r, 0, ndet * sizeof(uint16_t));
+   };
+
+   //--------------------------------------------------------------------------
+   // Unpack the tags of a record
+   inline void UnpackTags(const void *record, uint16_t *tags) const {
+      memcpy(tags, (const char *)record + GetValuesSize(),
+             ndet * sizeof(uint16_t));
+   };
+};
+
+#endif
@@ -0,0 +1,791 @@
+// Class to handle the root output file. The worker threads do not fill the
+// tree themselves. Instead, they fill blocks of events (see EventBlock.hh) and
+// hand them over here. A dedicated writer thread fills the tree from these
+// blocks, so the compression of the baskets happens on that thread and not on
+// the critical path of the workers. The workers only take the lock to swap a
+// full block for an empty one. There is a fixed pool of blocks, so if the
+// writer can't keep up, the workers wait rather than using more memory.
+//
+// The writer thread also fills an energy histogram for each detector and, if
+// we are given one, applies the detector response (see DetectorResponse.hh)
+// to the true deposits before writing them. Without a response, the tree and
+// histograms have the true deposits.
+//
+// With stratified sampling (see LevelScheme.hh), the events have weights. The
+// tree then has the weight of each event, the histograms are filled with the
+// weights (so they are TH1D rather than TH1I) and so are the moments of the
+// monitor.
+//
+// For adaptive stopping, we can also be given a timing analysis (see
+// TimingAnalysis.hh) to monitor. The writer thread passes each event to it
+// and after each block checks the uncertainties of the gated centroids. Once
+// they are all below the target, we flag that we are done, and the event
+// actions on the workers abort the run. A pair of detectors which gets too
+// few counts in a gate to ever reach the target is left out (see
+// TimingAnalysis::GetPrecision) and reported. The centroids and
+// uncertainties we reached are written to the file with the tree.
+//
+// For time-ordered listmode (see EventBuilder.hh), each worker has its own
+// stream of blocks, with the events in order of their start times, and at
+// the end of each run it marks the end of its stream. The writer thread does
+// a k-way merge of the streams, so it needs the next block of every worker
+// which is still running, and passes the events to the event builder in
+// time order. As the pool of blocks is fixed, the memory is bounded. Each
+// stream may only hold its share of the pool (the blocks it is filling, has
+// submitted or are being merged), so a worker which gets ahead of the others
+// waits for one of its own blocks to be written and can't take the blocks a
+// slower stream needs for the merge to go on. At the end of
+// a run, the builder is flushed and the next run starts after it. The tree
+// then has the start time (in ps) and pile-up of each built event as well.
+//
+// If we are given a shared memory segment (see LiveStatus.hh), the writer
+// thread publishes the status about once a second: the events written, the
+// events from each worker, the hits and spectrum of each detector and how
+// often the workers found the pool locked or had to wait for a block. It
+// counts all of these itself, per block, so the workers do nothing extra.
+//
+// The compression, basket size, AutoFlush/AutoSave cadence and root implicit
+// multithreading can be set with a string of comma-separated key=value pairs:
+//
+// compress=ALG:LEVEL  algorithm (zlib, lzma, lz4 or zstd) and level (0-9)
+// basket=N            basket size in bytes for the values branch
+// flush=N             AutoFlush (>0 number of events, <0 number of bytes)
+// save=N              AutoSave (>0 number of events, <0 number of bytes)
+// imt=N               number of threads for root implicit multithreading
+//                     (0 = off), used to compress baskets in parallel
+// block=N             number of events per block handed over by a worker
+// pool=N              number of blocks in the pool per worker (at least 2)
+//
+// The defaults are chosen for our typical event of 6 detectors x 5 doubles
+// (240 bytes), which is mostly zeros because few detectors fire per event.
+// Such events compress very well even with a fast algorithm, so we use LZ4,
+// which keeps the single writer thread ahead of the workers, and big
+// baskets and clusters so that there are few, large compression calls.
+//
+// The pool is the largest thing we allocate per worker (4 blocks of 1024
+// events by default), so with many threads, a smaller block or pool keeps the
+// memory down (see MemoryAccount.hh).
+//
+// The blocks and the tree have the layout of the record we are given (see
+// RecordLayout.hh). With a float layout, the values branch is float and the
+// writer unpacks each block into doubles for the response, the histograms
+// and the monitor, then narrows the record again for the tree. If the layout
+// has the tags of the deposits, the tree has a branch of them too (tags, an
+// unsigned short for each detector). The event builder doesn't keep them, so
+// they aren't written in time-ordered listmode.
+
+#ifndef __ROOT_OUTPUT_HH__
+#define __ROOT_OUTPUT_HH__
+
+#include <TFile.h>
+#include <TTree.h>
+#include <TH1I.h>
+#include <TH1D.h>
+#include <TROOT.h>
+#include <TString.h>
+#include <TObjArray.h>
+#include <TObjString.h>
+#include <TParameter.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+#include "EventBlock.hh"
+#include "DetectorResponse.hh"
+#include "TimingAnalysis.hh"
+#include "EventBuilder.hh"
+#include "LiveStatus.hh"
+#include "MemoryAccount.hh"
+
+//-----------------------------------------------------------------------------
+// Class for the root output
+class RootOutput {
+
+ private:
+   TFile *file;                        // Output file
+   TTree *tree;                        // Output tree
+   const RecordLayout *layout;         // Layout of the records
+   double *record;                     // Event currently being written
+   Float_t *frecord;                   // ... as written with a float layout
+   std::vector <double> unpacked;      // Values of the current block
+   std::vector <UShort_t> tags;        // Tags of the event being written
+   std::vector <uint16_t> unpacked_tags; // Tags of the current block
+   unsigned int ndet;                  // Number of detectors
+   unsigned int nperdet;               // Number of values per detector
+   unsigned int nvalues;               // Number of values per event
+   std::vector <TH1 *> h;              // Energy histogram for each detector
+   bool weighted;                      // Do the events have weights?
+   Double_t weight;                    // Weight of the event being written
+   DetectorResponse *response;         // Detector response (or NULL)
+   TimingAnalysis *monitor;            // Analysis to monitor (or NULL)
+   double target;                      // Target uncertainty in ps
+   bool pairs;                         // Target for each pair or all pairs?
+   std::atomic <bool> done;            // Have we reached the target?
+   EventBuilder *builder;              // Listmode event builder (or NULL)
+   Long64_t start;                     // Start of event in ps (listmode)
+   UInt_t pileup;                      // Number of piled-up hits (listmode)
+   LiveStatus *live;                   // Shared memory for status (or NULL)
+   std::chrono::steady_clock::time_point t_start;   // When we opened
+   std::chrono::steady_clock::time_point t_publish; // When we last published
+   std::vector <unsigned long long> thread_events;  // Events from each thread
+   std::vector <unsigned long long> hits; // Hits in each detector
+   unsigned long long nlocks;          // Number of times we locked the pool
+   unsigned long long ncontended;      // ... of which it was already locked
+   unsigned long long nwaits;          // Times a worker waited for a block
+   double wait_time;                   // Total time waiting in s
+   std::chrono::steady_clock::time_point t_first; // First block released
+   std::chrono::steady_clock::time_point t_last;  // Last block released
+   unsigned long long nreleased;       // Number of blocks released
+   unsigned long long nthroughput;     // Events after the first block
+   unsigned long long nwritten;        // Number of events written
+   int algorithm;                      // Compression algorithm
+   int level;                          // Compression level
+   int basketsize;                     // Basket size in bytes
+   Long64_t autoflush;                 // AutoFlush setting for the tree
+   Long64_t autosave;                  // AutoSave setting for the tree
+   int nimt;                           // Threads for implicit multithreading
+   unsigned int blocksize;             // Number of events per block
+   unsigned int poolsize;              // Number of blocks per worker
+   std::vector <EventBlock *> blocks;  // All the blocks
+   std::deque <EventBlock *> full;     // Blocks waiting to be written
+   std::deque <EventBlock *> empty;    // Blocks free for the workers
+   std::vector <unsigned int> held;    // Blocks held by each stream
+   std::vector <std::deque <EventBlock *> > streams; // Blocks of each
+                                       // worker in listmode (NULL = end of run)
+   std::mutex mutex;                   // Lock for the queues
+   std::condition_variable cond_full;  // Signalled when a block is full
+   std::condition_variable cond_empty; // Signalled when a block is free
+   std::thread writer;                 // Writer thread
+   bool running;                       // Is the writer thread running?
+   bool stop;                          // Tell the writer thread to finish
+
+   //--------------------------------------------------------------------------
+   // Get the root algorithm number from its name (-1 if unknown)
+   static int GetAlgorithm(const char *name) {
+      if (!strcasecmp(name, "zlib")) return(1);
+      if (!strcasecmp(name, "lzma")) return(2);
+      if (!strcasecmp(name, "lz4"))  return(4);
+      if (!strcasecmp(name, "zstd")) return(5);
+      return(-1);
+   };
+
+   //--------------------------------------------------------------------------
+   // Lock the pool, counting how often it was already locked. The counters
+   // are protected by the lock itself.
+   void Lock(std::unique_lock <std::mutex> &l) {
+      if (!l.try_lock()) {
+         l.lock();
+         ncontended++;
+      }
+      nlocks++;
+   };
+
+   //--------------------------------------------------------------------------
+   // Publish the status to the shared memory if it is time to (or always if
+   // force is set)
+   void Publish(bool force = false) {
+      if (!live) return;
+      std::chrono::steady_clock::time_point now =
+        std::chrono::steady_clock::now();
+      if (!force && now - t_publish < std::chrono::seconds(1)) return;
+      t_publish = now;
+      LiveData *d = live->Begin();
+      d->elapsed = std::chrono::duration <double> (now - t_start).count();
+      d->nevents = nwritten;
+      for (unsigned int i = 0; i < d->nthreads && i < thread_events.size(); i++)
+        d->thread_events[i] = thread_events[i];
+      for (unsigned int j = 0; j < d->ndet; j++) {
+         d->hits[j] = hits[j];
+         for (unsigned int b = 0; b < LIVE_NBINS; b++)
+           d->spectra[j * LIVE_NBINS + b] = (uint32_t)h[j]->GetBinContent(b + 1);
+      }
+      std::unique_lock <std::mutex> l(mutex);
+      d->nlocks = nlocks;
+      d->ncontended = ncontended;
+      d->nwaits = nwaits;
+      d->wait_time = wait_time;
+      l.unlock();
+      live->End();
+   };
+
+   //--------------------------------------------------------------------------
+   // Fill the tree and histograms with the record and pass it to the monitor
+   void Fill() {
+      if (frecord)
+        for (unsigned int j = 0; j < nvalues; j++) frecord[j] = record[j];
+      tree->Fill();
+      for (unsigned int j = 0; j < ndet; j++) {
+         if (record[j * nperdet] <= 0) continue;
+         h[j]->Fill(record[j * nperdet], weight);
+         hits[j]++;
+      }
+      if (monitor) monitor->Process(record, weight);
+   };
+
+   //--------------------------------------------------------------------------
+   // Check whether we have reached the target precision. We need a minimum
+   // number of counts, so we don't stop on an early fluke, and we report the
+   // pairs left out because they get too few counts to ever have it.
+   void CheckTarget() {
+      if (!monitor || done) return;
+      unsigned int nskipped;
+      if (monitor->GetPrecision(pairs, 100, nskipped) > target) return;
+      printf("Target precision of %g ps reached after %llu events\n",
+             target, nwritten);
+      if (nskipped)
+        printf("Left out %u gated pairs of detectors with too few counts (see the precision tree)\n",
+               nskipped);
+      done = true;
+   };
+
+   //--------------------------------------------------------------------------
+   // Give a block back to the workers, counting its events for the thread
+   // which filled it and for the throughput. The throughput is measured from
+   // the first block, so it doesn't include the initialisation.
+   void Release(EventBlock *block) {
+      if (block->GetStream() < thread_events.size())
+        thread_events[block->GetStream()] += block->GetNEvents();
+      if (nreleased++ == 0) t_first = std::chrono::steady_clock::now();
+      else {
+         t_last = std::chrono::steady_clock::now();
+         nthroughput += block->GetNEvents();
+      }
+      block->Clear();
+      std::unique_lock <std::mutex> l(mutex, std::defer_lock);
+      Lock(l);
+      Free(block);
+      l.unlock();
+      cond_empty.notify_all();
+   };
+
+   //--------------------------------------------------------------------------
+   // Put a block back in the pool and take it off its stream. The lock must
+   // be held.
+   void Free(EventBlock *block) {
+      empty.push_back(block);
+      if (block->GetStream() < held.size() && held[block->GetStream()])
+        held[block->GetStream()]--;
+   };
+
+   //--------------------------------------------------------------------------
+   // Can a stream have another block? In listmode, a stream may only hold
+   // poolsize blocks, so the others always have one left. The lock must be
+   // held.
+   bool IsFree(unsigned int stream) {
+      if (empty.empty()) return(false);
+      return(!builder || stream >= held.size() || held[stream] < poolsize);
+   };
+
+   //--------------------------------------------------------------------------
+   // Write the events the builder has ready, applying the detector response
+   // to each one
+   void WriteReady() {
+      for (unsigned int i = 0; i < builder->GetNReady(); i++) {
+         memcpy(record, builder->GetReady(i), sizeof(double) * nvalues);
+         start = builder->GetReadyStart(i);
+         pileup = builder->GetReadyPileup(i);
+         if (response) response->Apply(record, 1, nwritten);
+         Fill();
+         nwritten++;
+      }
+      builder->ClearReady();
+   };
+
+   //--------------------------------------------------------------------------
+   // The writer thread for listmode - merge the streams of the workers in
+   // order of the start times until we are told to stop and there is
+   // nothing left
+   void ListmodeWriter() {
+      unsigned int nstreams = streams.size();
+      std::vector <EventBlock *> current(nstreams, (EventBlock *)NULL);
+      std::vector <unsigned int> next(nstreams, 0);
+      std::vector <bool> ended(nstreams, false);
+      int64_t base = 0; // Start of the current run in ps
+      while(1) {
+
+         // Wait until every stream which hasn't ended has a block or the end
+         // of its run. When we are told to stop, all the runs have ended, so
+         // a stream with nothing is finished.
+         std::unique_lock <std::mutex> l(mutex, std::defer_lock);
+         Lock(l);
+         while (!cond_full.wait_for(l, std::chrono::seconds(1), [&] {
+            if (stop) return(true);
+            for (unsigned int s = 0; s < nstreams; s++)
+              if (!current[s] && !ended[s] && streams[s].empty())
+                return(false);
+            return(true);
+         })) {
+            l.unlock();
+            Publish();
+            Lock(l);
+         }
+         bool finished = false;
+         for (unsigned int s = 0; s < nstreams; s++) {
+            if (current[s] || ended[s]) continue;
+            if (streams[s].empty()) {
+               finished = true;
+               continue;
+            }
+            current[s] = streams[s].front();
+            streams[s].pop_front();
+            next[s] = 0;
+            if (!current[s]) ended[s] = true;
+         }
+         l.unlock();
+         if (finished) break;
+
+         // If all the streams have ended, this is the end of the run
+         bool all = true;
+         for (unsigned int s = 0; s < nstreams; s++)
+           if (!ended[s]) all = false;
+         if (all) {
+            builder->Flush();
+            WriteReady();
+            CheckTarget();
+            base = builder->GetLast() + 1;
+            ended.assign(nstreams, false);
+            continue;
+         }
+
+         // Merge the events in order of their start times until we have used
+         // up one of the blocks
+         while(1) {
+            int s = -1;
+            for (unsigned int i = 0; i < nstreams; i++) {
+               if (!current[i]) continue;
+               if (s < 0 || current[i]->GetStart(next[i]) <
+                   current[s]->GetStart(next[s])) s = i;
+            }
+            EventBlock *block = current[s];
+            block->GetEvent(next[s], unpacked.data());
+            builder->AddEvent(base + block->GetStart(next[s]),
+                              unpacked.data());
+            WriteReady();
+            if (++next[s] < block->GetNEvents()) continue;
+            Release(block);
+            current[s] = NULL;
+            break;
+         }
+         CheckTarget();
+         Publish();
+      }
+
+      // Process anything left
+      builder->Flush();
+      WriteReady();
+      Publish(true);
+   };
+
+   //--------------------------------------------------------------------------
+   // The writer thread - fill the tree from each full block in turn until we
+   // are told to stop and there are no more full blocks
+   void Writer() {
+      if (builder) {
+         ListmodeWriter();
+         return;
+      }
+      while(1) {
+
+         // Wait for a full block, publishing the status while we wait
+         std::unique_lock <std::mutex> l(mutex, std::defer_lock);
+         Lock(l);
+         while (!cond_full.wait_for(l, std::chrono::seconds(1), [this] {
+            return(stop || !full.empty()); })) {
+            l.unlock();
+            Publish();
+            Lock(l);
+         }
+         if (full.empty()) break; // Stopping and nothing left
+         EventBlock *block = full.front();
+         full.pop_front();
+         l.unlock();
+
+         // Unpack the block and apply the detector response to the whole of
+         // it
+         for (unsigned int i = 0; i < block->GetNEvents(); i++) {
+            block->GetEvent(i, unpacked.data() + i * nvalues);
+            if (!tags.empty())
+              block->GetTags(i, unpacked_tags.data() + i * ndet);
+         }
+         if (response)
+           response->Apply(unpacked.data(), block->GetNEvents(), nwritten);
+
+         // Fill the tree and histograms without holding the lock
+         for (unsigned int i = 0; i < block->GetNEvents(); i++) {
+            memcpy(record, unpacked.data() + i * nvalues,
+                   sizeof(double) * nvalues);
+            if (!tags.empty())
+              memcpy(tags.data(), unpacked_tags.data() + i * ndet,
+                     sizeof(UShort_t) * ndet);
+            weight = block->GetWeight(i);
+            Fill();
+         }
+         nwritten += block->GetNEvents();
+         CheckTarget();
+
+         // Give the block back to the workers
+         Release(block);
+         Publish();
+      }
+      Publish(true);
+   };
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Constructor
+   RootOutput() {
+      file = NULL;
+      tree = NULL;
+      layout = NULL;
+      record = NULL;
+      frecord = NULL;
+      ndet = 0;
+      nperdet = 0;
+      nvalues = 0;
+      weighted = false;
+      weight = 1;
+      response = NULL;
+      monitor = NULL;
+      target = 0;
+      pairs = true;
+      done = false;
+      builder = NULL;
+      start = 0;
+      pileup = 0;
+      live = NULL;
+      nlocks = ncontended = nwaits = 0;
+      nreleased = nthroughput = 0;
+      wait_time = 0;
+      nwritten = 0;
+      algorithm = 4;          // LZ4
+      level = 4;
+      basketsize = 256000;    // 256 kB
+      autoflush = -30000000;  // Cluster every 30 MB
+      autosave = -300000000;  // Save tree header every 300 MB
+      nimt = 0;
+      blocksize = 1024;
+      poolsize = 4;
+      running = false;
+      stop = false;
+   };
+
+   //--------------------------------------------------------------------------
+   // Destructor
+   ~RootOutput() {
+      Close();
+      for (unsigned int i = 0; i < blocks.size(); i++) delete blocks[i];
+      if (record) delete [] record;
+      if (frecord) delete [] frecord;
+   };
+
+   //--------------------------------------------------------------------------
+   // Set the options from a string of comma-separated key=value pairs.
+   // Returns false if any of them can't be understood.
+   bool Configure(const char *options) {
+      TString opts(options);
+      TObjArray *tokens = opts.Tokenize(",");
+      bool ok = true;
+      for (int i = 0; i < tokens->GetEntries(); i++) {
+         TString token = ((TObjString *)tokens->At(i))->GetString();
+         int eq = token.Index("=");
+         if (eq < 0) {
+            fprintf(stderr, "Bad root output option %s\n", token.Data());
+            ok = false;
+            continue;
+         }
+         TString key = token(0, eq);
+         TString value = token(eq + 1, token.Length());
+
+         if (key == "compress") {
+            int colon = value.Index(":");
+            TString alg = (colon < 0) ? value : TString(value(0, colon));
+            algorithm = GetAlgorithm(alg.Data());
+            if (colon >= 0) level = TString(value(colon + 1, value.Length())).Atoi();
+            if (algorithm < 0 || level < 0 || level > 9) {
+               fprintf(stderr, "Bad compression setting %s\n", value.Data());
+               ok = false;
+            }
+         } else if (key == "basket")
+           basketsize = value.Atoi();
+         else if (key == "flush")
+           autoflush = value.Atoll();
+         else if (key == "save")
+           autosave = value.Atoll();
+         else if (key == "imt")
+           nimt = value.Atoi();
+         else if (key == "block")
+           blocksize = (value.Atoi() > 0) ? value.Atoi() : 1;
+         else if (key == "pool")
+           poolsize = (value.Atoi() > 2) ? value.Atoi() : 2;
+         else {
+            fprintf(stderr, "Unknown root output option %s\n", key.Data());
+            ok = false;
+         }
+      }
+      delete tokens;
+      return(ok);
+   };
+
+   //--------------------------------------------------------------------------
+   // Show the settings
+   void Show() {
+      printf("Root output: compression = %d (algorithm %d level %d) basket = %d bytes\n",
+             algorithm * 100 + level, algorithm, level, basketsize);
+      printf("             autoflush = %lld autosave = %lld imt = %d block = %u events pool = %u blocks per worker\n",
+             autoflush, autosave, nimt, blocksize, poolsize);
+   };
+
+   //--------------------------------------------------------------------------
+   // Set the detector response to apply to the data as it is written. This
+   // must be called before Open.
+   void SetResponse(DetectorResponse *response_) {
+      response = response_;
+   };
+
+   //--------------------------------------------------------------------------
+   // Set the timing analysis to monitor and the target uncertainty of the
+   // centroids in ps, either for each pair of detectors or only for all pairs
+   // together. This must be called before Open.
+   void SetMonitor(TimingAnalysis *monitor_, double target_, bool pairs_) {
+      monitor = monitor_;
+      target = target_;
+      pairs = pairs_;
+   };
+
+   //--------------------------------------------------------------------------
+   // Set the event builder for time-ordered listmode. This must be called
+   // before Open.
+   void SetBuilder(EventBuilder *builder_) {
+      builder = builder_;
+   };
+
+   //--------------------------------------------------------------------------
+   // Say that the events have weights (stratified sampling), so we write
+   // them and use them. This must be called before Open.
+   void SetWeighted(bool weighted_) {
+      weighted = weighted_;
+   };
+
+   //--------------------------------------------------------------------------
+   // Set the shared memory to publish the status to. This must be called
+   // before Open.
+   void SetLive(LiveStatus *live_) {
+      live = live_;
+   };
+
+   //--------------------------------------------------------------------------
+   // Have we reached the target precision? The workers check this after
+   // each event.
+   bool IsDone() {
+      return(done.load(std::memory_order_relaxed));
+   };
+
+   //--------------------------------------------------------------------------
+   // Open the root file and create the tree with a branch of the values of
+   // each detector per event, as given by the layout of the record, and the
+   // energy histograms. We create enough blocks for each of nthreads workers
+   // to have one being filled and a few waiting to be written. In listmode,
+   // each of the nthreads workers has its own stream.
+   bool Open(const char *filename, const RecordLayout *layout_,
+             unsigned int nthreads) {
+
+      // Turn on root thread safety, as the tree is filled by our own thread
+      ROOT::EnableThreadSafety();
+      if (nimt > 0) ROOT::EnableImplicitMT(nimt);
+
+      // Open the file with the compression we want
+      file = TFile::Open(filename, "recreate", "", algorithm * 100 + level);
+      if (!file || file->IsZombie()) {
+         fprintf(stderr, "Unable to open root file %s\n", filename);
+         return(false);
+      }
+
+      // Create the tree and the branch
+      layout = layout_;
+      ndet = layout->GetNDetectors();
+      nperdet = layout->GetNPerDetector();
+      nvalues = layout->GetNValues();
+      record = new double[nvalues];
+      memset(record, 0, sizeof(double) * nvalues);
+      unpacked.resize(nvalues * blocksize);
+      tree = new TTree("g4", "geant4 tree");
+      if (layout->IsSingle()) {
+         frecord = new Float_t[nvalues];
+         memset(frecord, 0, sizeof(Float_t) * nvalues);
+         tree->Branch("values", frecord, Form("values[%d]/F", nvalues),
+                      basketsize);
+      } else
+        tree->Branch("values", record, Form("values[%d]/D", nvalues),
+                     basketsize);
+      if (layout->IsTagged()) {
+         tags.assign(ndet, 0);
+         unpacked_tags.resize(ndet * blocksize);
+         tree->Branch("tags", tags.data(), Form("tags[%d]/s", ndet));
+      }
+      if (builder) {
+         tree->Branch("start", &start, "start/L");
+         tree->Branch("pileup", &pileup, "pileup/i");
+         streams.resize(nthreads);
+      }
+      if (weighted) tree->Branch("weight", &weight, "weight/D");
+      tree->SetAutoFlush(autoflush);
+      tree->SetAutoSave(autosave);
+
+      // Create the histograms, which need the sums of the squares of the
+      // weights if the events have weights
+      for (unsigned int i = 0; i < ndet; i++) {
+         if (weighted) {
+            h.push_back(new TH1D(Form("LaBr3_%u", i), Form("LaBr3_%u", i),
+                                 3000, 0, 3000));
+            h.back()->Sumw2();
+         } else
+           h.push_back(new TH1I(Form("LaBr3_%u", i), Form("LaBr3_%u", i),
+                                3000, 0, 3000));
+      }
+
+      // Counters for the status
+      thread_events.assign(nthreads, 0);
+      held.assign(nthreads, 0);
+      hits.assign(ndet, 0);
+      t_start = t_publish = std::chrono::steady_clock::now();
+
+      // Create the pool of blocks
+      for (unsigned int i = 0; i < poolsize * nthreads + 2; i++) {
+         blocks.push_back(new EventBlock(layout, blocksize));
+         empty.push_back(blocks.back());
+      }
+      MemoryAccount::Add(kMemoryOutput, blocks.size() *
+                         (sizeof(EventBlock) + blocksize *
+                          (layout->GetSize() + sizeof(double) +
+                           sizeof(int64_t))) +
+                         sizeof(double) * unpacked.capacity() +
+                         sizeof(uint16_t) * (tags.capacity() +
+                                             unpacked_tags.capacity()));
+
+      // Start the writer thread
+      stop = false;
+      writer = std::thread(&RootOutput::Writer, this);
+      running = true;
+      return(true);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get an empty block for a worker to fill for its stream, waiting if
+   // there are none free or (in listmode) the stream holds its share
+   EventBlock *GetEmptyBlock(unsigned int stream) {
+      std::unique_lock <std::mutex> l(mutex, std::defer_lock);
+      Lock(l);
+      if (!IsFree(stream)) {
+         std::chrono::steady_clock::time_point t0 =
+           std::chrono::steady_clock::now();
+         cond_empty.wait(l, [&] { return(IsFree(stream)); });
+         nwaits++;
+         wait_time += std::chrono::duration <double>
+           (std::chrono::steady_clock::now() - t0).count();
+      }
+      EventBlock *block = empty.front();
+      empty.pop_front();
+      if (stream < held.size()) held[stream]++;
+      block->SetStream(stream);
+      return(block);
+   };
+
+   //--------------------------------------------------------------------------
+   // Hand a block over to the writer thread. Empty blocks go straight back
+   // to the pool. In listmode, the block goes to the stream it belongs to.
+   void Submit(EventBlock *block) {
+      std::unique_lock <std::mutex> l(mutex, std::defer_lock);
+      Lock(l);
+      if (block->GetNEvents() == 0) {
+         Free(block);
+         l.unlock();
+         cond_empty.notify_all();
+         return;
+      }
+      if (builder) streams[block->GetStream()].push_back(block);
+      else full.push_back(block);
+      l.unlock();
+      cond_full.notify_one();
+   };
+
+   //--------------------------------------------------------------------------
+   // Mark the end of the run for a stream (listmode only). Each worker must
+   // call this at the end of each run, after it has submitted its blocks.
+   void EndRun(unsigned int stream) {
+      if (!builder) return;
+      std::unique_lock <std::mutex> l(mutex, std::defer_lock);
+      Lock(l);
+      streams[stream].push_back(NULL);
+      l.unlock();
+      cond_full.notify_one();
+   };
+
+   //--------------------------------------------------------------------------
+   // Wait for the writer thread to write all the blocks and then write the
+   // file. All the workers must have submitted their blocks by now. Returns
+   // false if the file couldn't be written.
+   bool Write() {
+      if (running) {
+         std::unique_lock <std::mutex> l(mutex);
+         stop = true;
+         l.unlock();
+         cond_full.notify_one();
+         writer.join();
+         running = false;
+      }
+      if (!file) return(false);
+      file->cd();
+      if (monitor) {
+         monitor->WritePrecision();
+         TParameter <double> p("target", target);
+         p.Write();
+         printf("Monitored centroids after %llu events:\n", nwritten);
+         monitor->Show();
+      }
+      if (nreleased > 1) {
+         double dt = std::chrono::duration <double> (t_last - t_first).count();
+         TParameter <double> p("events_per_s", dt > 0 ? nthroughput / dt : 0);
+         printf("Throughput: %.1f events/s\n", p.GetVal());
+         p.Write();
+      }
+      file->Write();
+      if (file->TestBit(TFile::kWriteError)) {
+         fprintf(stderr, "Error writing root file %s\n", file->GetName());
+         return(false);
+      }
+      return(true);
+   };
+
+   //--------------------------------------------------------------------------
+   // Write a number to the file, e.g. for the normalisation
+   void WriteParameter(const char *name, double value) {
+      if (!file) return;
+      file->cd();
+      TParameter <double> p(name, value);
+      p.Write();
+   };
+
+   //--------------------------------------------------------------------------
+   // Close the file (this deletes the tree and histograms)
+   void Close() {
+      if (running) Write();
+      if (!file) return;
+      file->Close();
+      delete file;
+      file = NULL;
+      tree = NULL;
+      h.clear();
+   };
+};
+
+#endif
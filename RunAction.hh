@@ -0,0 +1,42 @@
+#ifndef __RUN_ACTION_HH__
+#define __RUN_ACTION_HH__
+
+#include <G4UserRunAction.hh>
+#include <G4Run.hh>
+
+#include "EventAction.hh"
+#include "EventContext.hh"
+
+//-----------------------------------------------------------------------------
+// Class to handle the start and end of a run. The event action of each worker
+// keeps a partly filled block of events, which we have to hand over to the
+// output at the end of the run, or the last events would only be written at
+// the next run (or never). For time-ordered listmode, the clock of each
+// worker starts again at zero for each run.
+class RunAction : public G4UserRunAction {
+
+ private:
+   EventAction *event_action; // Event action of this thread
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Constructor
+   RunAction(EventAction *event_action_) : G4UserRunAction() {
+      event_action = event_action_;
+   };
+
+   //--------------------------------------------------------------------------
+   // Start of run - reset the clock of this thread
+   void BeginOfRunAction(const G4Run *) {
+      EventContext::Get()->SetStart(0);
+   };
+
+   //--------------------------------------------------------------------------
+   // End of run - flush the block of events
+   void EndOfRunAction(const G4Run *) {
+      if (event_action) event_action->Flush(true);
+   };
+};
+
+#endif
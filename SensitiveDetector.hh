@@ -7,86 +7,134 @@
 #include <G4Step.hh>
 #include <G4TouchableHistory.hh>
 #include <G4Threading.hh>
-#include <Randomize.hh>
 
-#include <TH1I.h>
-#include <TROOT.h>
+#include <vector>
 
 #include "Datum.hh"
+#include "EventContext.hh"
+#include "TimePickoff.hh"
+#include "MemoryAccount.hh"
+#include "BranchInfo.hh"
 
 //-----------------------------------------------------------------------------
-// This class handles sensitive detectors. For each one, we make a root
-// histogram. A root file should be opened beforehand and not closed until
-// the instance of this class is destroyed, as the destructor writes it to
-// the root file. Optionally, you can set an energy pointer, which tells
-// the instance of the class where to store (as a double) the energy in keV
-// accumulated during the event. This can be used for listmode, where you
-// set the pointer for each detector to point to a different element of an
-// array and write that as an n'tuple. The user can set sigma coefficients
-// associated with the resolution. A linear interpolation is assumed.
+// This class handles sensitive detectors. You set the event context of the
+// thread, which tells the instance of the class where to accumulate the sums
+// during the event and where to store (as doubles) the energy in keV etc. at
+// the end of the event. This is used for listmode, where each detector writes
+// to a different element of the array in the Datum of the context. We only
+// store the true deposits - the resolution, time offsets etc. are applied
+// afterwards (see DetectorResponse.hh), so one simulation can be used for
+// many different detector responses.
+//
+// With a time pickoff (see TimePickoff.hh), the time stored is the time at
+// which the discriminator fires, worked out from the list of energy deposits
+// and their times, instead of the average time of the interactions.
+//
+// When a gamma is split (see SplittingOperator.hh), the tracks of each copy
+// are tagged with its branch (see BranchInfo.hh). We keep the sums of each
+// branch separately from those of the untagged tracks, which are common to
+// all the branches, and at the end of the event we store the data of each
+// branch, with the common sums added, in the Datum of that branch.
+//
+// If we tag the deposits (see RecordLayout.hh), we also sum the energy left
+// by each primary of the event, using the primary each track comes from (see
+// TrackingAction.hh). The tag of the detector has the transition of the
+// primary which left the most, whether it left all of its energy (full
+// absorption, within 0.01 keV) or only part of it (scattered into or out of
+// the crystal, escapes etc.) and whether any other primary left energy too.
 class SensitiveDetector : public G4VSensitiveDetector {
 
  private:
    Datum *data;           // Data for current event
-   double sigma0;         // Offset of sigma
-   double sigma1;         // Slope of sigma
-   TH1I *h;               // Histogram
-   double sumE;           // Energy sum
-   double sumT;           // Time
-   double sumN;           // Number of hits
-   double sumX;           // Sum over X-coordinate
-   double sumY;           // Sum over Y-coordinate
-   double sumZ;           // Sum over Z-coordinate
-   double offT;           // Time offset
+   Accumulator *sums;     // Sums for current event (in the event context)
+   EventContext *context; // Event context of the thread
+   std::vector <Accumulator> branch_sums; // Sums of each branch (splitting)
    int id;                // Detector ID
+   const TimePickoff *pickoff; // Time pickoff (NULL for the average time)
+   std::vector <double> hitE, hitT; // Energy and time of each deposit
+   std::vector <unsigned int> hitB; // Branch of each deposit (splitting)
+   std::vector <double> selE, selT; // Deposits of one branch
+   std::vector <double> u;          // Random numbers for the time pickoff
+   bool tagging;          // Do we tag the deposits?
+   unsigned int nprimaries; // Number of primaries of the event (tagging)
+   std::vector <double> primaryE; // Energy from each primary, common and
+                                  // for each branch (tagging)
+   CLHEP::HepRandomEngine *engine; // Random number engine of the thread
+   long reported;         // Bytes reported to the memory accounting
 
- public:
-   
    //--------------------------------------------------------------------------
-   // Constructor
-   SensitiveDetector(G4String name) : G4VSensitiveDetector(name) {
-      
-      // Create the root histogram and initialise the sigma coefficients
-      if (G4Threading::G4GetThreadId() == -1) // For master thread
-        h = new TH1I(name, name, 3000, 0, 3000);
-      else    // For others, find the one we created already
-        h = (TH1I *)gROOT->FindObject(name);
-
-      // Initialise coefficients
-      sigma0 = 0;
-      sigma1 = 1;
-      offT = 0;
+   // Work out the tag from the energy each primary left in common and in a
+   // branch (0 = not split)
+   uint16_t Tag(unsigned int branch) {
+      const double *common = primaryE.data();
+      const double *own = branch ? common + branch * nprimaries : NULL;
+      int best = -1;
+      double most = 0;
+      unsigned int n = 0;
+      for (unsigned int i = 0; i < nprimaries; i++) {
+         double e = common[i] + (own ? own[i] : 0);
+         if (e <= 0) continue;
+         n++;
+         if (e > most) {
+            most = e;
+            best = i;
+         }
+      }
+      if (best < 0) return(0);
+      uint16_t tag = context->GetPrimaryLine(best);
+      if (most >= context->GetPrimaryEnergy(best) - 0.01) tag |= kTagFull;
+      if (n > 1) tag |= kTagMixed;
+      return(tag);
    };
-   
+
    //--------------------------------------------------------------------------
-   // Destructor
-   ~SensitiveDetector() {
+   // Store the energy, time and position from the sums and the deposits E
+   // and T of n hits in a Datum, with the tag of the branch if we tag them
+   void Store(Datum &d, const Accumulator &a, const double *E,
+              const double *T, unsigned int n, unsigned int branch = 0) {
 
-      // Do nothing unless master thread
-      if (G4Threading::G4GetThreadId() != -1) return;
+      // Do nothing if below threshold of 0.01 keV
+      double sumE = a.sumE;
+      if (sumE < 0.01) return;
 
-      // Delete histogram
-      delete h;
+      // Store values in listmode data - item 0 is the energy deposited in the
+      // crystal, item 1 is the average time of the interactions (or the time
+      // from the pickoff if we have one and it fires), item 2 is
+      // the average x-coordinate of the interactions, item 3 for y and item
+      // 4 for z, if the layout of the record has the position.
+      double sumN = a.sumN;
+      double time = a.sumT / sumN; // Average time
+      if (pickoff) pickoff->Pick(E, T, n, engine, u, time);
+      d.Store(id, sumE, time, a.sumX / sumN, a.sumY / sumN, a.sumZ / sumN);
+      if (tagging) d.SetTag(id, Tag(branch));
    };
 
+ public:
+   
    //--------------------------------------------------------------------------
-   // Set the sigma coefficients for the resolution of the detector
-   void SetSigmaCoefficients(double sigma0_, double sigma1_) {
-      sigma0 = sigma0_;
-      sigma1 = sigma1_;
+   // Constructor
+   SensitiveDetector(G4String name) : G4VSensitiveDetector(name) {
+      data = NULL;
+      sums = NULL;
+      context = NULL;
+      id = 0;
+      pickoff = NULL;
+      engine = NULL;
+      tagging = false;
+      nprimaries = 0;
+      reported = 0;
+      MemoryAccount::Add(kMemoryDetectors, sizeof(SensitiveDetector));
    };
    
    //--------------------------------------------------------------------------
-   // Set time offset
-   void SetTimeOffset(double offT_) {
-      offT = offT_;
+   // Destructor
+   ~SensitiveDetector() {
    };
-   
+
    //--------------------------------------------------------------------------
-   // Set the pointer to the place where the energy is stored (appropriate
-   // to given thread)
-   void SetDataPointer(Datum *data_) {
-      data = data_;
+   // Use a time pickoff, which is shared by all the threads
+   void SetPickoff(const TimePickoff *pickoff_) {
+      pickoff = pickoff_;
    };
 
    //--------------------------------------------------------------------------
@@ -94,16 +142,35 @@ class SensitiveDetector : public G4VSensitiveDetector {
    void SetID(int id_) {
       id = id_;
    };
+
+   //--------------------------------------------------------------------------
+   // Set the event context of the thread, which is where the sums are
+   // accumulated and the energy etc. are stored. This must be called after
+   // SetID.
+   void SetContext(EventContext *context_) {
+      context = context_;
+      data = &context->GetDatum();
+      sums = &context->GetAccumulator(id);
+      engine = context->GetEngine();
+      branch_sums.resize(EventContext::GetSplitting());
+      tagging = EventContext::GetTagging();
+      MemoryAccount::Add(kMemoryDetectors,
+                         branch_sums.capacity() * sizeof(Accumulator));
+   };
    
    //--------------------------------------------------------------------------
    // Initialise an event - zero the sums
    void Initialize(G4HCofThisEvent *) {
-      sumE = 0;
-      sumT = 0;
-      sumX = 0;
-      sumY = 0;
-      sumZ = 0;
-      sumN = 0;
+      sums->Reset();
+      for (unsigned int i = 0; i < branch_sums.size(); i++)
+        branch_sums[i].Reset();
+      hitE.clear();
+      hitT.clear();
+      hitB.clear();
+      if (tagging) {
+         nprimaries = context->GetNPrimaries();
+         primaryE.assign((branch_sums.size() + 1) * nprimaries, 0.);
+      }
    };
    
    //--------------------------------------------------------------------------
@@ -117,38 +184,64 @@ class SensitiveDetector : public G4VSensitiveDetector {
       G4ThreeVector localPosition = theTouchable->GetHistory()->
         GetTopTransform().TransformPoint(worldPosition);
 
+      // Which branch does the track belong to (0 = all of them)?
+      const BranchInfo *info =
+        (const BranchInfo *)step->GetTrack()->GetUserInformation();
+      unsigned int branch = info ? info->GetBranch() : 0;
+      Accumulator *a = branch ? &branch_sums[branch - 1] : sums;
+
       // Increase sums
-      sumE += step->GetTotalEnergyDeposit()/keV; // in keV
-      sumT += preStepPoint->GetGlobalTime() / ns * 1000.; // in ps
-      sumX += localPosition.x() / mm; // Position in mm
-      sumY += localPosition.y() / mm; // Position in mm
-      sumZ += localPosition.z() / mm; // Position in mm
-      sumN += 1.;
+      double E = step->GetTotalEnergyDeposit()/keV; // in keV
+      double T = preStepPoint->GetGlobalTime() / ns * 1000.; // in ps
+      a->sumE += E;
+      a->sumT += T;
+      a->sumX += localPosition.x() / mm; // Position in mm
+      a->sumY += localPosition.y() / mm; // Position in mm
+      a->sumZ += localPosition.z() / mm; // Position in mm
+      a->sumN += 1.;
+
+      // Add it to the energy of the primary it comes from
+      if (tagging) {
+         int origin = context->GetOrigin(step->GetTrack()->GetTrackID());
+         if (origin >= 0 && (unsigned int)origin < nprimaries)
+           primaryE[branch * nprimaries + origin] += E;
+      }
+
+      // Keep the deposits for the time pickoff
+      if (pickoff && E > 0) {
+         hitE.push_back(E);
+         hitT.push_back(T);
+         hitB.push_back(branch);
+      }
       return(true);
    };
    
    //--------------------------------------------------------------------------
-   // End the event - store the energy and histogram it
+   // End the event - store the energy, time and position, for each branch
+   // if the event was split
    void EndOfEvent(G4HCofThisEvent *) {
-
-      // Do nothing if below threshold of 0.01 keV
-      if (sumE < 0.01) return;
-
-      // Spread energy over sigma
-      sumE = G4RandGauss::shoot(sumE, sigma0 + sigma1 * sumE);
-
-      // Store values in listmode data - item 0 is the energy deposited in the
-      // crystal, item 1 is the average time of the interactions, item 2 is
-      // the average x-coordinate of the interactions, item 3 for y and item
-      // 4 for z.
-      data->SetValue(id, 0, sumE); // Sum of energy deposited
-      data->SetValue(id, 1, sumT / sumN + offT); // Average time + offset
-      data->SetValue(id, 2, sumX / sumN);
-      data->SetValue(id, 3, sumY / sumN);
-      data->SetValue(id, 4, sumZ / sumN);
-      
-      // Fill histogram
-      h->Fill(sumE);
+      unsigned int nbranches = context->GetNBranches();
+      if (!nbranches)
+        Store(*data, *sums, hitE.data(), hitT.data(), hitE.size());
+      for (unsigned int b = 1; b <= nbranches; b++) {
+         Accumulator a = *sums;
+         a.Add(branch_sums[b - 1]);
+         selE.clear();
+         selT.clear();
+         for (unsigned int i = 0; i < hitB.size(); i++) {
+            if (hitB[i] && hitB[i] != b) continue;
+            selE.push_back(hitE[i]);
+            selT.push_back(hitT[i]);
+         }
+         Store(context->GetBranchDatum(b), a, selE.data(), selT.data(),
+               selE.size(), b);
+      }
+      if (pickoff || tagging)
+        MemoryAccount::Update(kMemoryDetectors, reported, sizeof(double) *
+                              (hitE.capacity() + hitT.capacity() +
+                               selE.capacity() + selT.capacity() +
+                               u.capacity() + primaryE.capacity()) +
+                              sizeof(unsigned int) * hitB.capacity());
    };
 };
 
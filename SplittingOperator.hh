@@ -0,0 +1,261 @@
+// Classes to split the gammas which scatter towards a crystal, using the
+// generic biasing of Geant4 (see PhysicsList.hh). The background we study is
+// the gammas which scatter in a case or a crystal into another crystal, but
+// few of them do, so most of the time goes into events without it.
+//
+// The operator is attached to the crystals and the cases and gives the
+// operation below for each step of a gamma in them. When a gamma leaves one
+// of them heading for a crystal and it has scattered (or was produced in the
+// detectors, e.g. an annihilation gamma), we replace it with N copies, each
+// of which starts a branch of the event (see BranchInfo.hh). Everything
+// which happened before the split is common to all the branches and the
+// sensitive detectors keep the deposits of each branch separately (see
+// SensitiveDetector.hh), so each branch is a complete event, with a weight of
+// 1/N, and the event action writes one for each branch (see EventAction.hh).
+// Only one gamma is split per event, but the branches share everything
+// before the split, so they aren't independent of each other and the errors
+// worked out from the weights are too small (see LaBr_timing.cc). The gammas
+// from the source which go straight into a crystal aren't split, as they are
+// plentiful anyway.
+//
+// When a gamma leaves a crystal or a case in a direction which misses every
+// case, it can only come back by scattering in the air, so we play Russian
+// roulette. The sensitive detectors and the output only know the weight of
+// the event (or of a branch), so the roulette acts on that: with a
+// probability of 1 - 1/N, the event is killed (or the branch of the gamma,
+// if it belongs to one) and isn't written, otherwise its weight is
+// multiplied by N and the gamma goes on. A killed event is aborted, so the
+// rest of it isn't tracked, and the gammas of a killed branch are killed
+// when they leave a volume.
+//
+// Each thread has its own operator and operation. Show() gives the numbers
+// of gammas split and of events or branches killed and kept by the roulette
+// over all the threads.
+
+#ifndef __SPLITTING_OPERATOR_HH__
+#define __SPLITTING_OPERATOR_HH__
+
+#include <G4VBiasingOperator.hh>
+#include <G4VBiasingOperation.hh>
+#include <G4BiasingProcessInterface.hh>
+#include <G4ParticleChange.hh>
+#include <G4EventManager.hh>
+#include <G4LogicalVolume.hh>
+#include <G4Track.hh>
+#include <G4Step.hh>
+#include <G4AutoLock.hh>
+
+#include <cstdio>
+#include <cfloat>
+#include <vector>
+#include <algorithm>
+
+#include "BranchInfo.hh"
+#include "Cylinder.hh"
+#include "EventContext.hh"
+
+//-----------------------------------------------------------------------------
+// Class for the operation which splits the gammas or plays roulette
+class SplitOperation : public G4VBiasingOperation {
+
+ private:
+   unsigned int factor;                       // Splitting factor N
+   const std::vector <Cylinder> *crystals;    // The crystals
+   const std::vector <Cylinder> *cases;       // The cases around them
+   G4ParticleChange change;                   // Our final state
+   unsigned long long nsplit;                 // Gammas split
+   unsigned long long nkilled;                // Killed by roulette
+   unsigned long long nsurvived;              // Kept by roulette
+
+   static std::vector <SplitOperation *> instances; // All the instances
+   static G4Mutex mutex;                      // Lock for the list
+
+   //--------------------------------------------------------------------------
+   // Does the ray from p in direction u hit any of the cylinders?
+   static bool HitsAny(const std::vector <Cylinder> &c, const G4ThreeVector &p,
+                       const G4ThreeVector &u) {
+      for (unsigned int i = 0; i < c.size(); i++)
+        if (c[i].Hits(p, u)) return(true);
+      return(false);
+   };
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Constructor - the splitting factor and the crystals and cases, which
+   // belong to the detector construction
+   SplitOperation(unsigned int factor_,
+                  const std::vector <Cylinder> *crystals_,
+                  const std::vector <Cylinder> *cases_) :
+     G4VBiasingOperation("SplitOperation") {
+      factor = factor_;
+      crystals = crystals_;
+      cases = cases_;
+      nsplit = nkilled = nsurvived = 0;
+      G4AutoLock l(&mutex);
+      instances.push_back(this);
+   };
+
+   //--------------------------------------------------------------------------
+   // Destructor
+   ~SplitOperation() {
+      G4AutoLock l(&mutex);
+      std::vector <SplitOperation *>::iterator it =
+        std::find(instances.begin(), instances.end(), this);
+      if (it != instances.end()) instances.erase(it);
+   };
+
+   //--------------------------------------------------------------------------
+   // We don't change the interaction lengths or the final states of the
+   // physics processes
+   const G4VBiasingInteractionLaw *
+   ProvideOccurenceBiasingInteractionLaw(const G4BiasingProcessInterface *,
+                                         G4ForceCondition &) {
+      return(NULL);
+   };
+   G4VParticleChange *ApplyFinalStateBiasing(const G4BiasingProcessInterface *,
+                                             const G4Track *, const G4Step *,
+                                             G4bool &) {
+      return(NULL);
+   };
+
+   //--------------------------------------------------------------------------
+   // We never limit the step, but we want to be called at the end of every
+   // step, so we can act when the gamma leaves the volume
+   G4double DistanceToApplyOperation(const G4Track *, G4double,
+                                     G4ForceCondition *condition) {
+      *condition = Forced;
+      return(DBL_MAX);
+   };
+
+   //--------------------------------------------------------------------------
+   // At the end of a step which leaves the volume, split the gamma if it is
+   // heading for a crystal or play roulette with its event (or branch) if it
+   // can't reach any detector. This includes the first step of a gamma made in
+   // the volume, e.g. by annihilation. The copies start in the same place as
+   // the gamma, so they can make a tiny first step in the volume, but they
+   // are never split again, as the event has its branches by then.
+   G4VParticleChange *GenerateBiasingFinalState(const G4Track *track,
+                                                const G4Step *step) {
+      change.Initialize(*track);
+      const G4StepPoint *post = step->GetPostStepPoint();
+      if (post->GetStepStatus() != fGeomBoundary) return(&change);
+      const G4ThreeVector &p = post->GetPosition();
+      const G4ThreeVector &u = post->GetMomentumDirection();
+      EventContext *context = EventContext::Get();
+
+      // Heading for a crystal - split it if it has scattered and nothing has
+      // been split in this event yet
+      if (HitsAny(*crystals, p, u)) {
+         bool scattered = (track->GetParentID() > 0 ||
+                           (u - track->GetVertexMomentumDirection()).mag2() >
+                           1e-12);
+         if (!scattered || context->GetNBranches()) return(&change);
+         context->Split();
+         double weight = track->GetWeight() / factor;
+         change.SetSecondaryWeightByProcess(true);
+         change.SetNumberOfSecondaries(factor);
+         for (unsigned int i = 1; i <= factor; i++) {
+            G4Track *copy = new G4Track(*track);
+            copy->SetWeight(weight);
+            copy->SetUserInformation(new BranchInfo(i));
+            change.AddSecondary(copy);
+         }
+         change.ProposeTrackStatus(fStopAndKill);
+         nsplit++;
+         return(&change);
+      }
+
+      // Can't reach any detector - Russian roulette with the branch of the
+      // gamma or, if it has none, the whole event
+      if (!HitsAny(*cases, p, u)) {
+         const BranchInfo *info =
+           (const BranchInfo *)track->GetUserInformation();
+         unsigned int branch = info ? info->GetBranch() : 0;
+         if (branch && context->GetBranchFactor(branch) <= 0) {
+            change.ProposeTrackStatus(fStopAndKill);
+         } else if (context->GetEngine()->flat() * factor >= 1.) {
+            change.ProposeTrackStatus(fStopAndKill);
+            if (branch) context->ScaleBranch(branch, 0);
+            else {
+               context->Kill();
+               G4EventManager::GetEventManager()->AbortCurrentEvent();
+            }
+            nkilled++;
+         } else {
+            if (branch) context->ScaleBranch(branch, factor);
+            else context->ScaleWeight(factor);
+            nsurvived++;
+         }
+      }
+      return(&change);
+   };
+
+   //--------------------------------------------------------------------------
+   // Show the numbers of gammas split and of events or branches killed and
+   // kept by the roulette over all the threads
+   static void Show() {
+      G4AutoLock l(&mutex);
+      unsigned long long split = 0, killed = 0, survived = 0;
+      for (unsigned int i = 0; i < instances.size(); i++) {
+         split += instances[i]->nsplit;
+         killed += instances[i]->nkilled;
+         survived += instances[i]->nsurvived;
+      }
+      printf("Splitting: %llu gammas split, Russian roulette killed %llu and "
+             "kept %llu\n", split, killed, survived);
+   };
+};
+std::vector <SplitOperation *> SplitOperation::instances;
+G4Mutex SplitOperation::mutex = G4MUTEX_INITIALIZER;
+
+//-----------------------------------------------------------------------------
+// Class for the operator, which gives the operation for every step of a gamma
+// in the volumes it is attached to
+class SplittingOperator : public G4VBiasingOperator {
+
+ private:
+   SplitOperation *operation; // The operation
+
+   //--------------------------------------------------------------------------
+   // The splitting and roulette act after the step, like a process which
+   // isn't a physics process
+   G4VBiasingOperation *
+   ProposeNonPhysicsBiasingOperation(const G4Track *,
+                                     const G4BiasingProcessInterface *) {
+      return(operation);
+   };
+
+   //--------------------------------------------------------------------------
+   // We don't bias the physics processes
+   G4VBiasingOperation *
+   ProposeOccurenceBiasingOperation(const G4Track *,
+                                    const G4BiasingProcessInterface *) {
+      return(NULL);
+   };
+   G4VBiasingOperation *
+   ProposeFinalStateBiasingOperation(const G4Track *,
+                                     const G4BiasingProcessInterface *) {
+      return(NULL);
+   };
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Constructor - the splitting factor and the crystals and cases, which
+   // belong to the detector construction
+   SplittingOperator(unsigned int factor,
+                     const std::vector <Cylinder> *crystals,
+                     const std::vector <Cylinder> *cases) :
+     G4VBiasingOperator("SplittingOperator") {
+      operation = new SplitOperation(factor, crystals, cases);
+   };
+
+   //--------------------------------------------------------------------------
+   // Destructor
+   ~SplittingOperator() {
+      delete operation;
+   };
+};
+
+#endif
@@ -0,0 +1,275 @@
+// Class to model the time pickoff of a LaBr3 detector analytically from the
+// energy deposits of the hits and their times, without tracking optical
+// photons. Each deposit of E keV at time t0 gives yield * E photoelectrons,
+// which arrive with the bi-exponential scintillation time distribution
+//
+// f(t) = (exp(-(t - t0) / decay) - exp(-(t - t0) / rise)) / (decay - rise)
+//
+// and each photoelectron is delayed by the transit-time spread of the PMT, a
+// Gaussian. So the photoelectrons of the whole event are a Poisson process
+// with the expected number up to time t
+//
+// L(t) = sum over deposits of yield * E * C(t - t0)
+//
+// where C is the integral of f convolved with the Gaussian, which we have in
+// closed form. The arrival times of such a process are those of a process
+// with one photoelectron per unit time, transformed with the inverse of L, so
+// the time of the kth photoelectron is the solution of L(t) = S, where S is
+// gamma distributed with shape k. We solve it with Newton's method in a loop
+// over the deposits which the compiler can vectorise, as the exponentials
+// and erfc come from VectorMath.hh rather than the C library.
+//
+// A leading-edge discriminator fires at the photoelectron given by its
+// threshold. A constant-fraction discriminator fires at a fixed fraction of
+// the amplitude of the pulse, which for the pulse shape f is a fixed fraction
+// of the photoelectrons, so it fires at the kth photoelectron, with k that
+// fraction of the total. Either way, the photoelectron statistics give the
+// time resolution and the time walk as they would for the real detector.
+//
+// The parameters are set with a string of comma-separated key=value pairs,
+// with times in ps:
+//
+// rise=T       rise time constant (default 400 ps)
+// decay=T      decay time constant (default 16000 ps)
+// yield=N      photoelectrons per keV (default 15)
+// tts=T        sigma of the transit-time spread (default 150 ps)
+// mode=cfd|le  constant-fraction or leading-edge discriminator (default cfd)
+// fraction=F   fraction for the constant-fraction discriminator (default 0.2)
+// threshold=N  photoelectrons for the leading-edge discriminator (default 5)
+
+#ifndef __TIME_PICKOFF_HH__
+#define __TIME_PICKOFF_HH__
+
+#include <Randomize.hh>
+
+#include <TString.h>
+#include <TObjArray.h>
+#include <TObjString.h>
+
+#include <cstdio>
+#include <cmath>
+#include <vector>
+
+#include "VectorMath.hh"
+
+//-----------------------------------------------------------------------------
+// Class for the time pickoff
+class TimePickoff {
+
+ private:
+   double rise;          // Rise time constant in ps
+   double decay;         // Decay time constant in ps
+   double yield;         // Photoelectrons per keV
+   double tts;           // Sigma of transit-time spread in ps
+   bool cfd;             // Constant fraction (or leading edge)?
+   double fraction;      // Constant fraction
+   double threshold;     // Leading-edge threshold in photoelectrons
+   double cfd_fraction;  // Fraction of photoelectrons at the CFD crossing
+
+   //--------------------------------------------------------------------------
+   // Integral of the pulse shape from 0 to x for one photoelectron
+   double Integral(double x) const {
+      return(1. - (decay * exp(-x / decay) - rise * exp(-x / rise)) /
+             (decay - rise));
+   };
+
+   //--------------------------------------------------------------------------
+   // Pulse shape for one photoelectron
+   double Shape(double x) const {
+      return((exp(-x / decay) - exp(-x / rise)) / (decay - rise));
+   };
+
+   //--------------------------------------------------------------------------
+   // Work out the fraction of the photoelectrons which have arrived when the
+   // pulse reaches the constant fraction of its amplitude on the leading edge
+   void Setup() {
+      if (decay <= rise) decay = rise * 1.001;
+      double tpeak = rise * decay / (decay - rise) * log(decay / rise);
+      double level = fraction * Shape(tpeak), lo = 0, hi = tpeak;
+      for (int i = 0; i < 100; i++) {
+         double x = 0.5 * (lo + hi);
+         if (Shape(x) < level) lo = x;
+         else hi = x;
+      }
+      cfd_fraction = Integral(0.5 * (lo + hi));
+   };
+
+   //--------------------------------------------------------------------------
+   // Expected number of photoelectrons up to time t and its derivative. With
+   // the transit-time spread s, the integral of the pulse shape is
+   //
+   // C(x) = P(x/s) - (decay * Ed * P(x/s - s/decay) -
+   //                  rise * Er * P(x/s - s/rise)) / (decay - rise)
+   //
+   // where P is the cumulative normal distribution and E is
+   // exp(s^2 / 2 / tau^2 - x / tau). Long before a deposit, this is zero, so
+   // we don't let x go below -8 s, where the exponentials could overflow.
+   double Expected(double t, const double *E, const double *T,
+                   unsigned int n, double &rate) const {
+      double sum = 0, d = 0;
+      double a = 1. / decay, b = 1. / rise, c = 1. / (decay - rise);
+      if (tts <= 0) {
+#pragma omp simd reduction(+:sum,d)
+         for (unsigned int i = 0; i < n; i++) {
+            double x = t - T[i];
+            x = (x > 0) ? x : 0;
+            double ed = VectorMath::Exp(-x * a), er = VectorMath::Exp(-x * b);
+            sum += E[i] * (1. - (decay * ed - rise * er) * c);
+            d += E[i] * (ed - er) * c;
+         }
+      } else {
+         double s = tts, ga = 0.5 * s * s * a * a, gb = 0.5 * s * s * b * b;
+#pragma omp simd reduction(+:sum,d)
+         for (unsigned int i = 0; i < n; i++) {
+            double x = t - T[i];
+            x = (x > -8. * s) ? x : -8. * s;
+            double y = x / s;
+            double ed = VectorMath::Exp(ga - x * a) * 0.5 *
+              VectorMath::Erfc(-(y - s * a) * M_SQRT1_2);
+            double er = VectorMath::Exp(gb - x * b) * 0.5 *
+              VectorMath::Erfc(-(y - s * b) * M_SQRT1_2);
+            sum += E[i] * (0.5 * VectorMath::Erfc(-y * M_SQRT1_2) -
+                           (decay * ed - rise * er) * c);
+            d += E[i] * (ed - er) * c;
+         }
+      }
+      rate = d * yield;
+      return(sum * yield);
+   };
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Constructor - typical values for a LaBr3(Ce) crystal on a fast PMT
+   TimePickoff() {
+      rise = 400;
+      decay = 16000;
+      yield = 15;
+      tts = 150;
+      cfd = true;
+      fraction = 0.2;
+      threshold = 5;
+      Setup();
+   };
+
+   //--------------------------------------------------------------------------
+   // Set the parameters from a string of comma-separated key=value pairs.
+   // Returns false if any of them can't be understood.
+   bool Configure(const char *options) {
+      TString opts(options);
+      TObjArray *tokens = opts.Tokenize(",");
+      bool ok = true;
+      for (int i = 0; i < tokens->GetEntries(); i++) {
+         TString token = ((TObjString *)tokens->At(i))->GetString();
+         int eq = token.Index("=");
+         if (eq < 0) {
+            fprintf(stderr, "Bad time pickoff option %s\n", token.Data());
+            ok = false;
+            continue;
+         }
+         TString key = token(0, eq);
+         TString value = token(eq + 1, token.Length());
+
+         if (key == "rise")
+           rise = value.Atof();
+         else if (key == "decay")
+           decay = value.Atof();
+         else if (key == "yield")
+           yield = value.Atof();
+         else if (key == "tts")
+           tts = value.Atof();
+         else if (key == "mode" && (value == "cfd" || value == "le"))
+           cfd = (value == "cfd");
+         else if (key == "fraction")
+           fraction = value.Atof();
+         else if (key == "threshold")
+           threshold = value.Atof();
+         else {
+            fprintf(stderr, "Unknown time pickoff option %s\n", token.Data());
+            ok = false;
+         }
+      }
+      delete tokens;
+      if (rise <= 0 || yield <= 0 || fraction <= 0 || fraction >= 1 ||
+          threshold < 1) {
+         fprintf(stderr, "Bad time pickoff settings %s\n", options);
+         ok = false;
+      }
+      Setup();
+      return(ok);
+   };
+
+   //--------------------------------------------------------------------------
+   // Show the settings
+   void Show() {
+      printf("Time pickoff: rise = %g ps decay = %g ps yield = %g pe/keV tts = %g ps\n",
+             rise, decay, yield, tts);
+      if (cfd)
+        printf("              CFD fraction = %g (%.4f of the photoelectrons)\n",
+               fraction, cfd_fraction);
+      else
+        printf("              leading edge threshold = %g photoelectrons\n",
+               threshold);
+   };
+
+   //--------------------------------------------------------------------------
+   // Pick off the time in ps of an event with n deposits of E keV at times T
+   // in ps. Returns false if the discriminator doesn't fire, because there
+   // aren't enough photoelectrons. The settings are only read, so one
+   // instance can be shared by all the threads, each of which gives its own
+   // engine and buffer u for the random numbers.
+   bool Pick(const double *E, const double *T, unsigned int n,
+             CLHEP::HepRandomEngine *engine, std::vector <double> &u,
+             double &time) const {
+
+      // Total number of photoelectrons and the first deposit
+      if (n == 0) return(false);
+      double total = 0, t0 = T[0];
+      for (unsigned int i = 0; i < n; i++) {
+         total += E[i];
+         if (T[i] < t0) t0 = T[i];
+      }
+      total *= yield;
+
+      // Which photoelectron fires the discriminator
+      double k = cfd ? floor(cfd_fraction * total + 0.5) : threshold;
+      if (k < 1) k = 1;
+
+      // Time of the kth photoelectron of the unit process (gamma
+      // distributed) - a sum of exponentials for small k, otherwise the
+      // Wilson-Hilferty approximation
+      unsigned int nu = (k <= 32) ? (unsigned int)k : 2;
+      if (u.size() < nu) u.resize(nu);
+      engine->flatArray(nu, u.data());
+      double S = 0;
+      if (k <= 32) {
+         double p = 1;
+         for (unsigned int i = 0; i < nu; i++) p *= u[i];
+         S = -log(p);
+      } else {
+         double z = sqrt(-2. * log(u[0])) * cos(2. * M_PI * u[1]);
+         double c = 1. / (9. * k);
+         double w = 1. - c + z * sqrt(c);
+         S = k * w * w * w;
+      }
+      if (S >= total) return(false);
+
+      // Solve L(t) = S with Newton's method, keeping a bracket in case it
+      // goes astray
+      double rate, lo = t0 - 8. * tts, hi = t0 + rise + 8. * tts;
+      while (Expected(hi, E, T, n, rate) < S) hi = t0 + 2. * (hi - t0);
+      double t = 0.5 * (lo + hi);
+      for (int i = 0; i < 50; i++) {
+         double L = Expected(t, E, T, n, rate);
+         if (L < S) lo = t;
+         else hi = t;
+         if (hi - lo < 0.01) break;
+         double next = (rate > 0) ? t - (L - S) / rate : lo;
+         t = (next > lo && next < hi) ? next : 0.5 * (lo + hi);
+      }
+      time = t;
+      return(true);
+   };
+};
+
+#endif
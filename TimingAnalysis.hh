@@ -0,0 +1,491 @@
+// Class to do the timing analysis of the listmode data. For each event, we
+// look at each ordered pair of detectors which fired (start and stop) and
+// apply energy gates to them. For each gate, we make a time-difference
+// spectrum (T(stop) - T(start) in ps) for each pair of detectors and for all
+// pairs together, and we keep the moments, so we can give the centroid and
+// its uncertainty exactly, regardless of the binning.
+//
+// We can also make the centroid-shift curves for the Compton background: for
+// a fixed gate on one line, we scan a narrow gate over a range of energies
+// for the other detector. The "delayed" centroid is with the fixed gate on
+// the start detector and the scanned gate on the stop detector and the
+// "anti-delayed" centroid is the other way round. As we look at both orders
+// of each pair, the anti-delayed time differences are just the delayed ones
+// of the other order with the opposite sign, so we only keep the delayed
+// moments and the anti-delayed centroid is minus the delayed one. The
+// difference between them, twice the delayed centroid, is the centroid shift
+// as a function of the scanned energy, and its uncertainty is twice that of
+// the delayed centroid, as the two aren't independent.
+//
+// The gates are read from a text file, with energies in keV:
+//
+// gate ESTART WSTART ESTOP WSTOP          - centre and half width of gates
+// scan EFIX WFIX EMIN EMAX STEP WIDTH      - centroid-shift curve
+//
+// Each thread has its own instance of this class and they are merged at the
+// end. The simulation also uses it (without spectra) to monitor the
+// precision of the centroids online, so it can stop when they are precise
+// enough (see RootOutput.hh).
+//
+// Events can have weights (stratified sampling, see LevelScheme.hh). The
+// moments are then weighted and the uncertainty of the centroid uses the
+// effective number of entries, (sum of w)^2 / (sum of w^2), which is just
+// the number of entries if all the weights are one.
+
+#ifndef __TIMING_ANALYSIS_HH__
+#define __TIMING_ANALYSIS_HH__
+
+#include <TH1D.h>
+#include <TFile.h>
+#include <TTree.h>
+#include <TGraphErrors.h>
+#include <TString.h>
+
+#include <cstdio>
+#include <cmath>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// Moments of a distribution, so we can get the centroid and its uncertainty
+struct Moments {
+   double n;     // Number of entries (sum of weights)
+   double n2;    // Sum of squares of weights
+   double sum;   // Sum of values
+   double sum2;  // Sum of squares of values
+
+   //--------------------------------------------------------------------------
+   // Constructor
+   Moments() {
+      n = n2 = sum = sum2 = 0;
+   };
+
+   //--------------------------------------------------------------------------
+   // Add a value with a weight
+   inline void Add(double x, double w = 1) {
+      n += w;
+      n2 += w * w;
+      sum += w * x;
+      sum2 += w * x * x;
+   };
+
+   //--------------------------------------------------------------------------
+   // Add the moments of another distribution
+   void Add(const Moments &m) {
+      n += m.n;
+      n2 += m.n2;
+      sum += m.sum;
+      sum2 += m.sum2;
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the effective number of entries
+   double Effective() const {
+      return(n2 > 0 ? n * n / n2 : 0);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the mean (i.e. the centroid)
+   double Mean() const {
+      return(n > 0 ? sum / n : 0);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the uncertainty of the mean
+   double Error() const {
+      double neff = Effective();
+      if (neff < 2) return(0);
+      double var = (sum2 - sum * sum / n) / (n - n2 / n);
+      return(var > 0 ? sqrt(var / neff) : 0);
+   };
+};
+
+//-----------------------------------------------------------------------------
+// A pair of energy gates (start and stop)
+struct Gate {
+   double start_low, start_high;  // Start gate in keV
+   double stop_low, stop_high;    // Stop gate in keV
+   std::vector <Moments> pairs;   // Moments for each pair of detectors
+   std::vector <TH1D *> h;        // Spectrum for each pair of detectors
+   TH1D *hall;                    // Spectrum for all pairs together
+};
+
+//-----------------------------------------------------------------------------
+// A centroid-shift scan
+struct Scan {
+   double fix_low, fix_high;        // Fixed gate in keV
+   double emin, step, width;        // Scanned gates (centre emin + i * step)
+   unsigned int nstep;              // Number of scanned gates
+   std::vector <Moments> delayed;   // Fixed gate on start
+};
+
+//-----------------------------------------------------------------------------
+// Class for the timing analysis
+class TimingAnalysis {
+
+ private:
+   unsigned int ndet;          // Number of detectors
+   unsigned int nperdet;       // Number of values per detector
+   double range;               // Time range of spectra in ps (+/-)
+   double binwidth;            // Bin width of spectra in ps
+   bool spectra;               // Do we make spectra or just the moments?
+   std::vector <Gate> gates;   // Energy gates
+   std::vector <Scan> scans;   // Centroid-shift scans
+   std::vector <unsigned int> fired; // Detectors which fired in the event
+   unsigned long long nevents; // Number of events processed
+
+   //--------------------------------------------------------------------------
+   // Create the spectra for a gate
+   void Book(Gate &g, unsigned int ig) {
+      int nbins = (int)(2 * range / binwidth + 0.5);
+      g.pairs.assign(ndet * ndet, Moments());
+      g.h.assign(ndet * ndet, (TH1D *)NULL);
+      g.hall = NULL;
+      if (!spectra) return;
+      for (unsigned int i = 0; i < ndet; i++) {
+         for (unsigned int j = 0; j < ndet; j++) {
+            if (i == j) continue;
+            g.h[i * ndet + j] =
+              new TH1D(Form("dt_g%u_%u_%u", ig, i, j),
+                       Form("Gate %u start %u stop %u;#DeltaT [ps]", ig, i, j),
+                       nbins, -range, range);
+         }
+      }
+      g.hall = new TH1D(Form("dt_g%u", ig),
+                        Form("Gate %u all pairs;#DeltaT [ps]", ig),
+                        nbins, -range, range);
+   };
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Constructor
+   TimingAnalysis(unsigned int ndet_, unsigned int nperdet_, double range_,
+                  double binwidth_, bool spectra_ = true) {
+      ndet = ndet_;
+      nperdet = nperdet_;
+      range = range_;
+      binwidth = binwidth_;
+      spectra = spectra_;
+      nevents = 0;
+      fired.reserve(ndet);
+   };
+
+   //--------------------------------------------------------------------------
+   // Copy constructor - copies the gates and scans but creates new empty
+   // spectra, so that each thread can have its own copy
+   TimingAnalysis(const TimingAnalysis &a) {
+      ndet = a.ndet;
+      nperdet = a.nperdet;
+      range = a.range;
+      binwidth = a.binwidth;
+      spectra = a.spectra;
+      nevents = 0;
+      fired.reserve(ndet);
+      for (unsigned int i = 0; i < a.gates.size(); i++)
+        AddGate(a.gates[i].start_low, a.gates[i].start_high,
+                a.gates[i].stop_low, a.gates[i].stop_high);
+      for (unsigned int i = 0; i < a.scans.size(); i++) {
+         scans.push_back(a.scans[i]);
+         scans.back().delayed.assign(scans.back().nstep, Moments());
+      }
+   };
+
+   //--------------------------------------------------------------------------
+   // Destructor
+   ~TimingAnalysis() {
+      for (unsigned int i = 0; i < gates.size(); i++) {
+         for (unsigned int j = 0; j < gates[i].h.size(); j++)
+           if (gates[i].h[j]) delete gates[i].h[j];
+         if (gates[i].hall) delete gates[i].hall;
+      }
+   };
+
+   //--------------------------------------------------------------------------
+   // Add a pair of gates given the low and high limits in keV
+   void AddGate(double start_low, double start_high, double stop_low,
+                double stop_high) {
+      Gate g;
+      g.start_low = start_low;
+      g.start_high = start_high;
+      g.stop_low = stop_low;
+      g.stop_high = stop_high;
+      gates.push_back(g);
+      Book(gates.back(), gates.size() - 1);
+   };
+
+   //--------------------------------------------------------------------------
+   // Add a centroid-shift scan
+   void AddScan(double efix, double wfix, double emin, double emax,
+                double step, double width) {
+      if (step <= 0 || emax < emin) return;
+      Scan s;
+      s.fix_low = efix - wfix;
+      s.fix_high = efix + wfix;
+      s.emin = emin;
+      s.step = step;
+      s.width = width;
+      s.nstep = (unsigned int)((emax - emin) / step) + 1;
+      s.delayed.assign(s.nstep, Moments());
+      scans.push_back(s);
+   };
+
+   //--------------------------------------------------------------------------
+   // Read the gates from a file. Returns false if we can't read it.
+   bool Read(const char *filename) {
+
+      // Open the file
+      FILE *fp = fopen(filename, "r");
+      if (!fp) {
+         fprintf(stderr, "Unable to read file %s\n", filename);
+         return(false);
+      }
+
+      // Parse it
+      TString st;
+      while(st.Gets(fp)) {
+         double a[6];
+
+         // Try to read a gate
+         if (sscanf(st.Data(), "gate %lf%lf%lf%lf", &a[0], &a[1], &a[2],
+                    &a[3]) == 4)
+           AddGate(a[0] - a[1], a[0] + a[1], a[2] - a[3], a[2] + a[3]);
+
+         // Try to read a scan
+         if (sscanf(st.Data(), "scan %lf%lf%lf%lf%lf%lf", &a[0], &a[1], &a[2],
+                    &a[3], &a[4], &a[5]) == 6)
+           AddScan(a[0], a[1], a[2], a[3], a[4], a[5]);
+      }
+
+      // Close the file
+      fclose(fp);
+      return(true);
+   };
+
+   //--------------------------------------------------------------------------
+   // Process an event - values is the array of the tree and weight the
+   // weight of the event
+   void Process(const double *values, double weight = 1) {
+
+      nevents++;
+
+      // Find the detectors which fired
+      fired.clear();
+      for (unsigned int i = 0; i < ndet; i++)
+        if (values[i * nperdet] > 0) fired.push_back(i);
+      if (fired.size() < 2) return;
+
+      // Loop over ordered pairs of detectors
+      for (unsigned int a = 0; a < fired.size(); a++) {
+         unsigned int i = fired[a];
+         double E1 = values[i * nperdet];
+         double T1 = values[i * nperdet + 1];
+         for (unsigned int b = 0; b < fired.size(); b++) {
+            if (a == b) continue;
+            unsigned int j = fired[b];
+            double E2 = values[j * nperdet];
+            double dT = values[j * nperdet + 1] - T1;
+
+            // Gates
+            for (unsigned int g = 0; g < gates.size(); g++) {
+               Gate &gate = gates[g];
+               if (E1 < gate.start_low || E1 > gate.start_high) continue;
+               if (E2 < gate.stop_low || E2 > gate.stop_high) continue;
+               gate.pairs[i * ndet + j].Add(dT, weight);
+               if (!spectra) continue;
+               gate.h[i * ndet + j]->Fill(dT, weight);
+               gate.hall->Fill(dT, weight);
+            }
+
+            // Scans - only the delayed case for this order of the pair, as
+            // the anti-delayed case is the same pair the other way round
+            for (unsigned int s = 0; s < scans.size(); s++) {
+               Scan &scan = scans[s];
+               if (E1 < scan.fix_low || E1 > scan.fix_high) continue;
+               int k = (int)floor((E2 - scan.emin) / scan.step + 0.5);
+               if (k >= 0 && k < (int)scan.nstep &&
+                   fabs(E2 - scan.emin - k * scan.step) <= scan.width)
+                 scan.delayed[k].Add(dT, weight);
+            }
+         }
+      }
+   };
+
+   //--------------------------------------------------------------------------
+   // Add the results of another instance (from another thread)
+   void Merge(const TimingAnalysis &a) {
+      nevents += a.nevents;
+      for (unsigned int g = 0; g < gates.size(); g++) {
+         for (unsigned int p = 0; p < gates[g].pairs.size(); p++) {
+            gates[g].pairs[p].Add(a.gates[g].pairs[p]);
+            if (gates[g].h[p]) gates[g].h[p]->Add(a.gates[g].h[p]);
+         }
+         if (gates[g].hall) gates[g].hall->Add(a.gates[g].hall);
+      }
+      for (unsigned int s = 0; s < scans.size(); s++) {
+         for (unsigned int k = 0; k < scans[s].nstep; k++)
+           scans[s].delayed[k].Add(a.scans[s].delayed[k]);
+      }
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the number of events processed
+   unsigned long long GetNEvents() {
+      return(nevents);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the number of gates
+   unsigned int GetNGates() {
+      return(gates.size());
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the spectrum of a gate for a pair of detectors (NULL if there isn't
+   // one)
+   TH1D *GetSpectrum(unsigned int gate, unsigned int start, unsigned int stop) {
+      if (gate >= gates.size() || start >= ndet || stop >= ndet) return(NULL);
+      return(gates[gate].h[start * ndet + stop]);
+   };
+
+   //--------------------------------------------------------------------------
+   // Get the precision we have reached, i.e. the worst uncertainty of the
+   // centroids of all the gates, either for each pair of detectors or for all
+   // pairs together. Any centroid with fewer than nmin (effective) counts
+   // doesn't count as precise yet, so we return a huge value. For each pair,
+   // a pair which still has fewer than nmin counts when its gate has ten
+   // times nmin per pair (e.g. two detectors which can't both see the gate)
+   // would stop the run from ever reaching the target, so it is left out and
+   // counted in nskipped. At least one pair of a gate always has enough.
+   double GetPrecision(bool pairs, double nmin, unsigned int &nskipped) {
+      double worst = 0;
+      unsigned int npairs = ndet * (ndet - 1);
+      nskipped = 0;
+      for (unsigned int g = 0; g < gates.size(); g++) {
+         Moments all;
+         for (unsigned int i = 0; i < ndet; i++)
+           for (unsigned int j = 0; j < ndet; j++)
+             if (i != j) all.Add(gates[g].pairs[i * ndet + j]);
+         if (all.Effective() < nmin) return(1e30);
+         if (!pairs) {
+            if (all.Error() > worst) worst = all.Error();
+            continue;
+         }
+         bool skip = all.Effective() >= 10 * nmin * npairs;
+         for (unsigned int i = 0; i < ndet; i++) {
+            for (unsigned int j = 0; j < ndet; j++) {
+               if (i == j) continue;
+               Moments &m = gates[g].pairs[i * ndet + j];
+               if (m.Effective() < nmin) {
+                  if (!skip) return(1e30);
+                  nskipped++;
+                  continue;
+               }
+               if (m.Error() > worst) worst = m.Error();
+            }
+         }
+      }
+      return(worst);
+   };
+
+   //--------------------------------------------------------------------------
+   // Write the centroids and their uncertainties to a tree called precision
+   // in the current directory, with one entry for each gate and pair (and
+   // start = stop = -1 for all pairs together)
+   void WritePrecision() {
+      int gate, start, stop;
+      double counts, centroid, error;
+      TTree *t = new TTree("precision", "centroids and uncertainties");
+      t->Branch("gate", &gate, "gate/I");
+      t->Branch("start", &start, "start/I");
+      t->Branch("stop", &stop, "stop/I");
+      t->Branch("counts", &counts, "counts/D");
+      t->Branch("centroid", &centroid, "centroid/D");
+      t->Branch("error", &error, "error/D");
+      for (unsigned int g = 0; g < gates.size(); g++) {
+         Moments all;
+         gate = g;
+         for (unsigned int i = 0; i < ndet; i++) {
+            for (unsigned int j = 0; j < ndet; j++) {
+               if (i == j) continue;
+               Moments &m = gates[g].pairs[i * ndet + j];
+               all.Add(m);
+               start = i;
+               stop = j;
+               counts = m.n;
+               centroid = m.Mean();
+               error = m.Error();
+               t->Fill();
+            }
+         }
+         start = stop = -1;
+         counts = all.n;
+         centroid = all.Mean();
+         error = all.Error();
+         t->Fill();
+      }
+      t->Write();
+   };
+
+   //--------------------------------------------------------------------------
+   // Print the centroids for each gate and pair
+   void Show() {
+      printf("%llu events\n", nevents);
+      for (unsigned int g = 0; g < gates.size(); g++) {
+         Gate &gate = gates[g];
+         printf("Gate %u: start %.1f-%.1f keV stop %.1f-%.1f keV\n", g,
+                gate.start_low, gate.start_high, gate.stop_low,
+                gate.stop_high);
+         Moments all;
+         for (unsigned int i = 0; i < ndet; i++) {
+            for (unsigned int j = 0; j < ndet; j++) {
+               Moments &m = gate.pairs[i * ndet + j];
+               if (i == j || m.n == 0) continue;
+               printf("\tstart %2u stop %2u: %10.0f counts centroid = %9.3f +- %7.3f ps\n",
+                      i, j, m.n, m.Mean(), m.Error());
+               all.Add(m);
+            }
+         }
+         printf("\tall pairs      : %10.0f counts centroid = %9.3f +- %7.3f ps\n",
+                all.n, all.Mean(), all.Error());
+      }
+   };
+
+   //--------------------------------------------------------------------------
+   // Write the spectra and the centroid-shift curves to the current directory
+   void Write() {
+      for (unsigned int g = 0; g < gates.size(); g++) {
+         for (unsigned int p = 0; p < gates[g].h.size(); p++)
+           if (gates[g].h[p]) gates[g].h[p]->Write();
+         if (gates[g].hall) gates[g].hall->Write();
+      }
+      for (unsigned int s = 0; s < scans.size(); s++) {
+         Scan &scan = scans[s];
+         TGraphErrors *gd = new TGraphErrors(scan.nstep);
+         TGraphErrors *ga = new TGraphErrors(scan.nstep);
+         TGraphErrors *gs = new TGraphErrors(scan.nstep);
+         for (unsigned int k = 0; k < scan.nstep; k++) {
+            double E = scan.emin + k * scan.step;
+            Moments &d = scan.delayed[k];
+            gd->SetPoint(k, E, d.Mean());
+            gd->SetPointError(k, 0, d.Error());
+            ga->SetPoint(k, E, -d.Mean());
+            ga->SetPointError(k, 0, d.Error());
+            gs->SetPoint(k, E, 2 * d.Mean());
+            gs->SetPointError(k, 0, 2 * d.Error());
+         }
+         gd->SetName(Form("delayed_%u", s));
+         ga->SetName(Form("antidelayed_%u", s));
+         gs->SetName(Form("shift_%u", s));
+         gs->SetTitle(Form("Centroid shift, fixed gate %.1f-%.1f keV;E [keV];#DeltaC [ps]",
+                           scan.fix_low, scan.fix_high));
+         gd->Write();
+         ga->Write();
+         gs->Write();
+         delete gd;
+         delete ga;
+         delete gs;
+      }
+   };
+};
+
+#endif
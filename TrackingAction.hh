@@ -0,0 +1,57 @@
+// Class to pass the branch of a track (see BranchInfo.hh) on to its
+// secondaries when it has been tracked, so the deposits of the electrons of
+// a split gamma go to its branch. If we tag the deposits (see
+// SensitiveDetector.hh), it also notes the primary each track comes from in
+// the event context when it starts. It is only needed when we split gammas
+// or tag the deposits.
+
+#ifndef __TRACKING_ACTION_HH__
+#define __TRACKING_ACTION_HH__
+
+#include <G4UserTrackingAction.hh>
+#include <G4TrackingManager.hh>
+#include <G4Track.hh>
+
+#include "BranchInfo.hh"
+#include "EventContext.hh"
+
+//-----------------------------------------------------------------------------
+// Class for the tracking action
+class TrackingAction : public G4UserTrackingAction {
+
+ private:
+   EventContext *context; // Event context of this thread (if we tag)
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Constructor
+   TrackingAction() {
+      context = NULL;
+   };
+
+   //--------------------------------------------------------------------------
+   // At the start of a track, note which primary it comes from, if we tag
+   // the deposits
+   void PreUserTrackingAction(const G4Track *track) {
+      if (!EventContext::GetTagging()) return;
+      if (!context) context = EventContext::Get();
+      context->SetOrigin(track->GetTrackID(), track->GetParentID());
+   };
+
+   //--------------------------------------------------------------------------
+   // At the end of a track, tag its secondaries with its branch, if it has
+   // one
+   void PostUserTrackingAction(const G4Track *track) {
+      const BranchInfo *info = (const BranchInfo *)track->GetUserInformation();
+      if (!info) return;
+      G4TrackVector *secondaries = fpTrackingManager->GimmeSecondaries();
+      if (!secondaries) return;
+      unsigned int branch = info->GetBranch();
+      for (unsigned int i = 0; i < secondaries->size(); i++)
+        if (!(*secondaries)[i]->GetUserInformation())
+          (*secondaries)[i]->SetUserInformation(new BranchInfo(branch));
+   };
+};
+
+#endif
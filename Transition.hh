@@ -1,5 +1,5 @@
-// Class to represent a single transition. We have its energy, intensity and a
-// pointer to the level it populates
+// Class to represent a single transition. We have its energy, intensity, a
+// pointer to the level it populates and its index in the level scheme
 
 #ifndef __TRANSITION_HH__
 #define __TRANSITION_HH__
@@ -16,34 +16,43 @@ class Transition {
    double energy;    // Energy of the transition
    double intensity; // Intensity of the transition
    Level *final;     // Level populated by the transition
+   unsigned int index; // Index in the level scheme (in order of reading)
 
  public:
    
    //--------------------------------------------------------------------------
    // Constructor
-   Transition(Level *final_, double intensity_, double energy_) {
+   Transition(Level *final_, double intensity_, double energy_,
+              unsigned int index_ = 0) {
       final = final_;
       intensity = intensity_;
       energy = energy_;
+      index = index_;
    };
 
    //--------------------------------------------------------------------------
    // Get the intensity of the transition
-   inline double GetIntensity() {
+   inline double GetIntensity() const {
       return(intensity);
    };
 
    //--------------------------------------------------------------------------
    // Get the energy of the transition
-   inline double GetEnergy() {
+   inline double GetEnergy() const {
       return(energy);
    };
 
    //--------------------------------------------------------------------------
    // Get the final level (i.e. the one populated by this transition)
-   inline Level *GetFinal() {
+   inline Level *GetFinal() const {
       return(final);
    };
+
+   //--------------------------------------------------------------------------
+   // Get the index of the transition in the level scheme
+   inline unsigned int GetIndex() const {
+      return(index);
+   };
 };
 
 #endif
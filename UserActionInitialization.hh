@@ -5,34 +5,52 @@
 
 #include "PrimaryGenerator.hh"
 #include "EventAction.hh"
-#include "Datum.hh"
-
-#include <TTree.h>
+#include "RunAction.hh"
+#include "RootOutput.hh"
+#include "RandomSetup.hh"
+#include "TrackingAction.hh"
 
 class UserActionInitialization : public G4VUserActionInitialization {
 
  private:
-   TTree *tree;
-   Datum *data;
-   int ndata;
-   const char *levelscheme;
+   RootOutput *output;
+   const RandomSetup *random;
+   const LevelScheme *levelscheme; // Shared by all the threads
+   double rate; // Decay rate per thread in Bq (time-ordered listmode)
+   const AcceptanceMap *acceptance; // Map to skip unreachable gammas (or NULL)
+   bool split; // Are gammas split (see SplittingOperator.hh)?
+   EventInput *input; // Input file of primary events (or NULL)
    
  public:
    //--------------------------------------------------------------------------
    // Constructor
-   UserActionInitialization(Datum *data_, int ndata_, TTree *tree_,
-                            const char *levelscheme_) : G4VUserActionInitialization() {
-      data = data_;
-      ndata = ndata_;
-      tree = tree_;
+   UserActionInitialization(RootOutput *output_,
+                            const LevelScheme *levelscheme_,
+                            const RandomSetup *random_, double rate_ = 0,
+                            const AcceptanceMap *acceptance_ = NULL,
+                            bool split_ = false, EventInput *input_ = NULL) :
+     G4VUserActionInitialization() {
+      output = output_;
+      random = random_;
       levelscheme = levelscheme_;
+      rate = rate_;
+      acceptance = acceptance_;
+      split = split_;
+      input = input_;
    }
 
    //--------------------------------------------------------------------------
-   // Build method - set up primary generator and event action
+   // Build method - set up primary generator, event action and run action,
+   // and the tracking action to pass on the branches if we split gammas and
+   // note the primaries of the tracks if we tag the deposits
    void Build() const {
-      SetUserAction(new PrimaryGenerator(levelscheme));
-      SetUserAction(new EventAction(data, ndata, tree));
+      EventAction *event_action = new EventAction(output);
+      SetUserAction(new PrimaryGenerator(levelscheme, random, rate,
+                                         acceptance, input));
+      SetUserAction(event_action);
+      SetUserAction(new RunAction(event_action));
+      if (split || EventContext::GetTagging())
+        SetUserAction(new TrackingAction());
    }
 };
 
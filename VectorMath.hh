@@ -0,0 +1,160 @@
+// Class with the maths functions we need in the loops which the compiler
+// vectorises (see CascadeBlock.hh, DetectorResponse.hh and TimePickoff.hh).
+// The functions of the C library (log, sin, cos etc.) are calls into the
+// library, which the compiler can only replace with vector versions with
+// -ffast-math and a vector maths library, so a loop which calls them isn't
+// vectorised at all. These are written with plain arithmetic and bit
+// manipulation, without calls or branches, so they are inlined and the loops
+// are vectorised with the flags of the Makefile (check with -fopt-info-vec).
+// The results are within a few units in the last place of those of the C
+// library, except for Erfc, whose relative error is below 1.2e-7, which is
+// plenty for the photoelectron statistics.
+//
+// The argument is reduced to a small range, using the bits of the exponent
+// or the integer part, and the function is then a polynomial on that range.
+// Nothing is checked, so the arguments must be in the range given for each
+// function (no NaNs, infinities or denormals).
+
+#ifndef __VECTOR_MATH_HH__
+#define __VECTOR_MATH_HH__
+
+#include <cstring>
+#include <cmath>
+#include <stdint.h>
+
+//-----------------------------------------------------------------------------
+// Class for the vectorisable maths functions
+class VectorMath {
+
+ private:
+
+   //--------------------------------------------------------------------------
+   // The bits of a double and the double of some bits
+   static inline uint64_t Bits(double x) {
+      uint64_t i;
+      memcpy(&i, &x, sizeof(i));
+      return(i);
+   };
+   static inline double Double(uint64_t i) {
+      double x;
+      memcpy(&x, &i, sizeof(x));
+      return(x);
+   };
+
+   //--------------------------------------------------------------------------
+   // Adding 1.5 * 2^52 to a double of less than 2^51 rounds it to an integer,
+   // which is then in the low bits of the sum
+   static constexpr double kRound = 6755399441055744.;
+
+ public:
+
+   //--------------------------------------------------------------------------
+   // Natural logarithm of a positive, normal x. With x = m * 2^e and m
+   // between sqrt(1/2) and sqrt(2), log(m) = 2 atanh(f) with f = (m-1)/(m+1),
+   // whose series converges quickly as |f| < 0.172.
+   static inline double Log(double x) {
+      uint64_t bits = Bits(x);
+      double e = Double(0x4330000000000000ULL | (bits >> 52)) -
+        4503599627370496. - 1023.;
+      double m = Double((bits & 0x000fffffffffffffULL) |
+                        0x3ff0000000000000ULL);
+      double big = (m > M_SQRT2) ? 1. : 0.;
+      m *= 1. - 0.5 * big;
+      e += big;
+      double f = (m - 1.) / (m + 1.), s = f * f;
+      double p = 1. / 21.;
+      p = p * s + 1. / 19.;
+      p = p * s + 1. / 17.;
+      p = p * s + 1. / 15.;
+      p = p * s + 1. / 13.;
+      p = p * s + 1. / 11.;
+      p = p * s + 1. / 9.;
+      p = p * s + 1. / 7.;
+      p = p * s + 1. / 5.;
+      p = p * s + 1. / 3.;
+      p = p * s + 1.;
+      return(e * M_LN2 + 2. * f * p);
+   };
+
+   //--------------------------------------------------------------------------
+   // Exponential of x, which is clamped to between -708 and 709, so the
+   // result is always a normal number. With x = k ln(2) + r and |r| <=
+   // ln(2)/2, exp(x) = 2^k exp(r), where 2^k goes straight into the exponent
+   // bits and exp(r) is its Taylor series.
+   static inline double Exp(double x) {
+      x = (x > -708.) ? x : -708.;
+      x = (x < 709.) ? x : 709.;
+      double k = x * M_LOG2E + kRound;
+      uint64_t bits = Bits(k);
+      k -= kRound;
+      double r = x - k * 6.93147180369123816490e-01 -
+        k * 1.90821492927058770002e-10;
+      double p = 1. / 6227020800.;
+      p = p * r + 1. / 479001600.;
+      p = p * r + 1. / 39916800.;
+      p = p * r + 1. / 3628800.;
+      p = p * r + 1. / 362880.;
+      p = p * r + 1. / 40320.;
+      p = p * r + 1. / 5040.;
+      p = p * r + 1. / 720.;
+      p = p * r + 1. / 120.;
+      p = p * r + 1. / 24.;
+      p = p * r + 1. / 6.;
+      p = p * r + 0.5;
+      p = p * r + 1.;
+      p = p * r + 1.;
+      return(p * Double((bits - Bits(kRound) + 1023) << 52));
+   };
+
+   //--------------------------------------------------------------------------
+   // Complementary error function, with the Chebyshev fit of Numerical
+   // Recipes (erfcc), using erfc(-x) = 2 - erfc(x)
+   static inline double Erfc(double x) {
+      double z = std::fabs(x), t = 1. / (1. + 0.5 * z);
+      double p = 0.17087277;
+      p = p * t - 0.82215223;
+      p = p * t + 1.48851587;
+      p = p * t - 1.13520398;
+      p = p * t + 0.27886807;
+      p = p * t - 0.18628806;
+      p = p * t + 0.09678418;
+      p = p * t + 0.37409196;
+      p = p * t + 1.00002368;
+      p = p * t - 1.26551223;
+      double y = t * Exp(p - z * z);
+      double sign = (x >= 0) ? 1. : -1.;
+      return(1. - sign + sign * y);
+   };
+
+   //--------------------------------------------------------------------------
+   // Sine and cosine of 2 pi u for |u| < 2^48. We take the nearest quarter
+   // turn q, whose last two bits say which of +-sin and +-cos of the rest r
+   // (|r| <= pi/4) we want, and swap and flip the signs with bit masks.
+   static inline void SinCos2Pi(double u, double &s, double &c) {
+      double q = 4. * u + kRound;
+      uint64_t n = Bits(q);
+      q -= kRound;
+      double r = (4. * u - q) * M_PI_2, r2 = r * r;
+      double sp = -1. / 1307674368000.;
+      sp = sp * r2 + 1. / 6227020800.;
+      sp = sp * r2 - 1. / 39916800.;
+      sp = sp * r2 + 1. / 362880.;
+      sp = sp * r2 - 1. / 5040.;
+      sp = sp * r2 + 1. / 120.;
+      sp = sp * r2 - 1. / 6.;
+      double cp = 1. / 20922789888000.;
+      cp = cp * r2 - 1. / 87178291200.;
+      cp = cp * r2 + 1. / 479001600.;
+      cp = cp * r2 - 1. / 3628800.;
+      cp = cp * r2 + 1. / 40320.;
+      cp = cp * r2 - 1. / 720.;
+      cp = cp * r2 + 1. / 24.;
+      cp = cp * r2 - 0.5;
+      uint64_t bs = Bits(r + r * r2 * sp), bc = Bits(1. + r2 * cp);
+      uint64_t odd = 0 - (n & 1);
+      s = Double(((bs & ~odd) | (bc & odd)) ^ ((n & 2) << 62));
+      c = Double(((bc & ~odd) | (bs & odd)) ^ (((n + 1) & 2) << 62));
+   };
+};
+
+#endif
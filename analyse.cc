@@ -0,0 +1,297 @@
+// Compiled timing analysis of the output of LaBr_timing. The tree is split
+// into its clusters (the units in which it was compressed) and the clusters
+// are shared out between the threads. Each thread opens the file itself and
+// has its own TimingAnalysis (see TimingAnalysis.hh), and at the end we merge
+// them and write the spectra and the centroid-shift curves to a root file.
+// Optionally, a detector response (see DetectorResponse.hh) can be applied to
+// the data as it is read, so that a simulation with the true deposits can be
+// analysed with any resolution without running it again. If the tree has
+// weights (stratified sampling), the events are weighted. The values can be
+// double or float and the number of values per detector is taken from the
+// file (values_per_detector) unless it is given with -p (see RecordLayout.hh).
+//
+// If the tree has the tags of the deposits, a selection of them can be given
+// with -k, as a comma-separated list of transitions (numbered from 1, as
+// shown by LaBr_timing), each optionally followed by :full or :scattered,
+// e.g. -k 1,3:scattered. The hits of the other deposits are dropped before
+// the analysis, so the spectra and centroids of each component of one run
+// can be made separately.
+
+#include <TFile.h>
+#include <TTree.h>
+#include <TLeaf.h>
+#include <TH1.h>
+#include <TROOT.h>
+#include <TParameter.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <unistd.h>
+
+#include "TimingAnalysis.hh"
+#include "DetectorResponse.hh"
+#include "RecordLayout.hh"
+
+//-----------------------------------------------------------------------------
+// Range of entries in one cluster
+struct Cluster {
+   Long64_t first; // First entry
+   Long64_t last;  // One after the last entry
+};
+
+//-----------------------------------------------------------------------------
+// A selection of the tags: a transition and what its gamma must have done
+struct TagSelection {
+   unsigned int line; // Number of the transition
+   int full;          // 1 = fully absorbed, 0 = scattered, -1 = either
+};
+
+//-----------------------------------------------------------------------------
+// Read a selection like "1,3:scattered". Returns false if we can't.
+bool ReadSelection(const char *spec, std::vector <TagSelection> &selection) {
+   std::vector <char> copy(spec, spec + strlen(spec) + 1);
+   for (char *token = strtok(copy.data(), ","); token;
+        token = strtok(NULL, ",")) {
+      TagSelection sel;
+      char what[16] = "";
+      if (sscanf(token, "%u:%15s", &sel.line, what) < 1 || sel.line < 1 ||
+          sel.line > kTagLine) return(false);
+      if (!what[0]) sel.full = -1;
+      else if (!strcmp(what, "full")) sel.full = 1;
+      else if (!strcmp(what, "scattered")) sel.full = 0;
+      else return(false);
+      selection.push_back(sel);
+   }
+   return(!selection.empty());
+}
+
+//-----------------------------------------------------------------------------
+// Is a tag in the selection?
+bool IsSelected(const std::vector <TagSelection> &selection, UShort_t tag) {
+   for (unsigned int i = 0; i < selection.size(); i++) {
+      if ((tag & kTagLine) != selection[i].line) continue;
+      if (selection[i].full < 0 ||
+          selection[i].full == ((tag & kTagFull) ? 1 : 0)) return(true);
+   }
+   return(false);
+}
+
+//-----------------------------------------------------------------------------
+// Worker thread - take clusters until there are none left
+void Worker(const char *filename, const std::vector <Cluster> *clusters,
+            std::atomic <unsigned int> *next, TimingAnalysis *analysis,
+            const DetectorResponse *response, unsigned int nvalues,
+            unsigned int nperdet,
+            const std::vector <TagSelection> *selection) {
+
+   // Open the file and get the tree
+   TFile *f = TFile::Open(filename);
+   if (!f || f->IsZombie()) return;
+   TTree *tree = (TTree *)f->Get("g4");
+   if (!tree) return;
+   std::vector <double> values(nvalues);
+   std::vector <Float_t> fvalues;
+   double weight = 1;
+   bool single = !strcmp(tree->GetLeaf("values")->GetTypeName(), "Float_t");
+   if (single) {
+      fvalues.resize(nvalues);
+      tree->SetBranchAddress("values", fvalues.data());
+   } else
+     tree->SetBranchAddress("values", values.data());
+   if (tree->GetBranch("weight")) tree->SetBranchAddress("weight", &weight);
+   unsigned int ndet = nvalues / nperdet;
+   std::vector <UShort_t> tags(ndet);
+   if (!selection->empty()) tree->SetBranchAddress("tags", tags.data());
+
+   // Each thread has its own copy of the response, as it has its own random
+   // number engine
+   DetectorResponse *resp = response ? new DetectorResponse(*response) : NULL;
+
+   // Process the clusters
+   while(1) {
+      unsigned int i = (*next)++;
+      if (i >= clusters->size()) break;
+      for (Long64_t entry = (*clusters)[i].first;
+           entry < (*clusters)[i].last; entry++) {
+         tree->GetEntry(entry);
+         if (single)
+           for (unsigned int j = 0; j < nvalues; j++) values[j] = fvalues[j];
+         if (resp) resp->Apply(values.data(), 1, entry);
+         if (!selection->empty())
+           for (unsigned int j = 0; j < ndet; j++)
+             if (!IsSelected(*selection, tags[j]))
+               memset(values.data() + j * nperdet, 0,
+                      sizeof(double) * nperdet);
+         analysis->Process(values.data(), weight);
+      }
+   }
+
+   // Close the file
+   f->Close();
+   delete f;
+   if (resp) delete resp;
+}
+
+//-----------------------------------------------------------------------------
+int main(int argc, char **argv) {
+
+   int c, nthreads = std::thread::hardware_concurrency(), nperdet = 0;
+   const char *input = "LaBr_timing.root";
+   const char *output = "analyse.root";
+   const char *gatefile = "gates.dat";
+   const char *responsefile = NULL;
+   double range = 10000, binwidth = 5;
+   std::vector <TagSelection> selection;
+   extern char *optarg;
+
+   // Handle arguments
+   while(1) {
+      c = getopt(argc, argv, "b:d:g:i:k:o:p:r:t:");
+      if (c == -1) break;
+
+      switch(c) {
+       case 'b': // Bin width in ps
+         binwidth = atof(optarg);
+         break;
+       case 'd': // Detector response
+         responsefile = optarg;
+         break;
+       case 'g': // Gate file
+         gatefile = optarg;
+         break;
+       case 'i': // Input root file
+         input = optarg;
+         break;
+       case 'k': // Selection of the tags
+         if (!ReadSelection(optarg, selection)) {
+            fprintf(stderr, "Bad selection of tags %s\n", optarg);
+            exit(-1);
+         }
+         break;
+       case 'o': // Output root file
+         output = optarg;
+         break;
+       case 'p': // Number of values per detector
+         nperdet = atoi(optarg);
+         break;
+       case 'r': // Time range in ps
+         range = atof(optarg);
+         break;
+       case 't': // Number of threads
+         nthreads = atoi(optarg);
+         break;
+       default:
+         fprintf(stderr, "Usage: %s [-b binwidth_ps] [-d response_file] [-g gatefile] [-i input_rootfile] [-k transition[:full|scattered],...] [-o output_rootfile] [-p values_per_detector] [-r range_ps] [-t nthreads]\n", argv[0]);
+         exit(-1);
+         break;
+      }
+   }
+   if (nthreads < 1) nthreads = 1;
+
+   // The threads each have their own histograms, which must not be attached
+   // to any file
+   ROOT::EnableThreadSafety();
+   TH1::AddDirectory(false);
+
+   // Open the input to find the number of detectors and the clusters
+   TFile *f = TFile::Open(input);
+   if (!f || f->IsZombie()) {
+      fprintf(stderr, "Unable to open %s\n", input);
+      exit(-1);
+   }
+   TTree *tree = (TTree *)f->Get("g4");
+   if (!tree || !tree->GetLeaf("values")) {
+      fprintf(stderr, "No g4 tree with values in %s\n", input);
+      exit(-1);
+   }
+   unsigned int nvalues = tree->GetLeaf("values")->GetLenStatic();
+   TParameter <double> *p =
+     (TParameter <double> *)f->Get("values_per_detector");
+   if (nperdet <= 0) nperdet = p ? (int)p->GetVal() : 5;
+   unsigned int ndet = nvalues / nperdet;
+   Long64_t nentries = tree->GetEntries();
+
+   // Show the transitions we select, with their energies if the file has
+   // them
+   if (!selection.empty()) {
+      if (!tree->GetBranch("tags")) {
+         fprintf(stderr, "No tags in %s to select\n", input);
+         exit(-1);
+      }
+      printf("Keeping the hits of:");
+      for (unsigned int i = 0; i < selection.size(); i++) {
+         TParameter <double> *e = (TParameter <double> *)
+           f->Get(Form("transition_%u", selection[i].line));
+         printf(" %u", selection[i].line);
+         if (e) printf(" (%.2f keV)", e->GetVal());
+         if (selection[i].full >= 0)
+           printf(" %s", selection[i].full ? "full" : "scattered");
+      }
+      printf("\n");
+   }
+   std::vector <Cluster> clusters;
+   TTree::TClusterIterator it = tree->GetClusterIterator(0);
+   Long64_t first;
+   while ((first = it.Next()) < nentries) {
+      Cluster cl;
+      cl.first = first;
+      cl.last = it.GetNextEntry();
+      if (cl.last > nentries) cl.last = nentries;
+      clusters.push_back(cl);
+   }
+   f->Close();
+   delete f;
+   printf("%s: %lld events, %u detectors, %lu clusters, %d threads\n", input,
+          nentries, ndet, (unsigned long)clusters.size(), nthreads);
+
+   // Read the gates
+   TimingAnalysis analysis(ndet, nperdet, range, binwidth);
+   if (!analysis.Read(gatefile)) exit(-1);
+
+   // Read the detector response, if any
+   DetectorResponse *response = NULL;
+   if (responsefile) {
+      response = new DetectorResponse(ndet, nperdet);
+      if (!response->Read(responsefile)) exit(-1);
+      response->Show();
+   }
+
+   // Start the threads, each with its own copy of the analysis
+   std::vector <TimingAnalysis *> analyses;
+   std::vector <std::thread> threads;
+   std::atomic <unsigned int> next(0);
+   auto t0 = std::chrono::steady_clock::now();
+   for (int i = 0; i < nthreads; i++) {
+      analyses.push_back(new TimingAnalysis(analysis));
+      threads.push_back(std::thread(Worker, input, &clusters, &next,
+                                    analyses.back(), response, nvalues,
+                                    nperdet, &selection));
+   }
+
+   // Wait for them and merge the results
+   for (int i = 0; i < nthreads; i++) {
+      threads[i].join();
+      analysis.Merge(*analyses[i]);
+      delete analyses[i];
+   }
+   double dt = std::chrono::duration <double>
+     (std::chrono::steady_clock::now() - t0).count();
+   printf("Processed in %.2f s (%.2f Mevents/s)\n", dt, nentries / dt / 1e6);
+
+   // Show the results and write them
+   analysis.Show();
+   TFile *fout = TFile::Open(output, "recreate");
+   if (!fout || fout->IsZombie()) {
+      fprintf(stderr, "Unable to open %s\n", output);
+      exit(-1);
+   }
+   analysis.Write();
+   fout->Close();
+   delete fout;
+   if (response) delete response;
+}
@@ -0,0 +1,317 @@
+// Micro-benchmarks of the components of the simulation, each driven on its
+// own with synthetic input, so the cost of one hot path can be measured
+// without the noise of a whole run (geometry, physics, root compression
+// etc.). We measure:
+//
+// - filling blocks of cascades from the level scheme (CascadeBlock::Fill),
+//   by walking through it and with stratified sampling of its paths
+// - PrimaryGenerator::GeneratePrimaries into a dummy event
+// - SensitiveDetector::ProcessHits with fabricated steps and the whole
+//   event of the sensitive detector (Initialize, the hits and EndOfEvent),
+//   with and without the time pickoff
+// - copying, resetting and setting the values of a Datum and packing it into
+//   the record of a block and unpacking it again, with the layout of -L
+// - EventAction::EndOfEventAction filling the blocks of a real RootOutput
+//   from several threads at once, including waiting for the writer thread
+//
+// Each measurement is run once to warm up and then repeated, and we give the
+// mean and the standard deviation of the repetitions in ns per operation and
+// the relative standard deviation, so we can see whether a difference
+// between two builds is real.
+
+#include <G4Event.hh>
+#include <G4Step.hh>
+#include <G4StepPoint.hh>
+#include <G4Track.hh>
+#include <G4DynamicParticle.hh>
+#include <G4TouchableHistory.hh>
+#include <G4Gamma.hh>
+#include <G4SystemOfUnits.hh>
+#include <Randomize.hh>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <unistd.h>
+
+#include "CascadeBlock.hh"
+#include "Datum.hh"
+#include "EventAction.hh"
+#include "EventContext.hh"
+#include "LevelScheme.hh"
+#include "PrimaryGenerator.hh"
+#include "RandomSetup.hh"
+#include "RecordLayout.hh"
+#include "RootOutput.hh"
+#include "SensitiveDetector.hh"
+#include "TimePickoff.hh"
+
+static const int nrepeat = 5; // Number of repetitions of each measurement
+static volatile double sink;  // Where results go, so loops aren't dropped
+
+//-----------------------------------------------------------------------------
+// Get the time in ns
+double Now() {
+   return(std::chrono::duration <double, std::nano>
+          (std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+//-----------------------------------------------------------------------------
+// Print the mean and standard deviation of the measurements
+void Report(const char *what, const char *per, std::vector <double> &t) {
+   double sum = 0, sum2 = 0;
+   for (unsigned int i = 0; i < t.size(); i++) {
+      sum += t[i];
+      sum2 += t[i] * t[i];
+   }
+   double mean = sum / t.size();
+   double sigma = sqrt(fabs(sum2 / t.size() - mean * mean));
+   printf("%-36s %10.2f +- %7.2f ns per %-8s (%5.1f %%)\n", what, mean, sigma,
+          per, mean > 0 ? 100. * sigma / mean : 0.);
+}
+
+//-----------------------------------------------------------------------------
+// Run op (which does nops operations) once to warm up and then nrepeat times,
+// reporting the time per operation
+template <class Op>
+void Measure(const char *what, const char *per, long nops, Op op) {
+   std::vector <double> t;
+   op();
+   for (int r = 0; r < nrepeat; r++) {
+      double t0 = Now();
+      op();
+      t.push_back((Now() - t0) / nops);
+   }
+   Report(what, per, t);
+}
+
+//-----------------------------------------------------------------------------
+// Make a step in a crystal with a random energy deposit, time and position.
+// The touchable has an empty history, so the local position is the global
+// one.
+G4Step *MakeStep(CLHEP::HepRandomEngine *rng) {
+   G4ThreeVector position((rng->flat() - 0.5) * 38. * mm,
+                          (rng->flat() - 0.5) * 38. * mm,
+                          (rng->flat() - 0.5) * 50. * mm);
+   G4DynamicParticle *particle =
+     new G4DynamicParticle(G4Gamma::GammaDefinition(),
+                           G4ThreeVector(0, 0, 1), 662. * keV);
+   G4Step *step = new G4Step();
+   step->SetTrack(new G4Track(particle, 0., position));
+   G4StepPoint *pre = step->GetPreStepPoint();
+   pre->SetPosition(position);
+   pre->SetGlobalTime(rng->flat() * ns);
+   pre->SetTouchableHandle(G4TouchableHandle(new G4TouchableHistory()));
+   step->SetTotalEnergyDeposit((1. + 499. * rng->flat()) * keV);
+   return(step);
+}
+
+//-----------------------------------------------------------------------------
+// Fill nevents events with one hit each into the blocks of the output with
+// an event action, as a worker would. This runs in its own thread.
+void Fill(RootOutput *output, unsigned int ndet, long nevents) {
+   EventContext *context = EventContext::Get();
+   EventAction action(output);
+   Datum &data = context->GetDatum();
+   G4Event event;
+   for (long i = 0; i < nevents; i++) {
+      data.SetValue(i % ndet, 0, 662.);
+      data.SetValue(i % ndet, 1, 1000.);
+      action.EndOfEventAction(&event);
+   }
+   action.Flush(true);
+}
+
+//-----------------------------------------------------------------------------
+int main(int argc, char **argv) {
+
+   int c, nthreads = 4, nhits = 4;
+   unsigned int ndet = 6;
+   long nevents = 1000000;
+   const char *levelscheme = "levelscheme.dat";
+   const char *filename = "bench_components.root";
+   const char *engine = "mixmax";
+   const char *pickoff_options = NULL;
+   const char *root_options = NULL;
+   RecordLayout layout;
+   extern char *optarg;
+
+   // Handle arguments
+   while(1) {
+      c = getopt(argc, argv, "e:h:l:L:n:N:o:r:t:T:");
+      if (c == -1) break;
+
+      switch(c) {
+       case 'e': // Random number engine
+         engine = optarg;
+         break;
+       case 'h': // Hits per event in the sensitive detector
+         nhits = atoi(optarg);
+         if (nhits < 1) nhits = 1;
+         break;
+       case 'l': // Level scheme
+         levelscheme = optarg;
+         break;
+       case 'L': // Layout of the event record
+         if (!layout.Configure(optarg)) {
+            fprintf(stderr, "Bad record layout %s\n", optarg);
+            exit(-1);
+         }
+         break;
+       case 'n': // Number of events per measurement
+         nevents = atol(optarg);
+         break;
+       case 'N': // Number of detectors
+         ndet = atoi(optarg);
+         if (ndet < 1) ndet = 1;
+         break;
+       case 'o': // Root file for the event action
+         filename = optarg;
+         break;
+       case 'r': // Root output options
+         root_options = optarg;
+         break;
+       case 't': // Maximum number of threads for the event action
+         nthreads = atoi(optarg);
+         if (nthreads < 1) nthreads = 1;
+         break;
+       case 'T': // Time pickoff options
+         pickoff_options = optarg;
+         break;
+       default:
+         fprintf(stderr, "Usage: %s [-e engine[:luxury]] [-h hits_per_event] [-l levelscheme] [-L record_layout] [-n number_of_events] [-N number_of_detectors] [-o output_rootfile] [-r root_options] [-t max_threads] [-T pickoff_options]\n", argv[0]);
+         exit(-1);
+         break;
+      }
+   }
+
+   // Read the level scheme twice, once for stratified sampling
+   LevelScheme ls, stratified;
+   if (!ls.Read(levelscheme) || !stratified.Read(levelscheme)) exit(-1);
+   bool strata = stratified.Stratify(1, kCascadeBlockSize);
+
+   // Set up the engine of this thread and the event context
+   RandomSetup random;
+   if (!random.SetEngine(engine)) exit(-1);
+   random.SetSeed(12345);
+   G4Random::setTheEngine(random.Create());
+   G4Random::setTheSeed(12345);
+   layout.SetNDetectors(ndet);
+   layout.Show();
+   unsigned int nperdet = layout.GetNPerDetector();
+   EventContext::SetDimensions(ndet, nperdet);
+   EventContext::SetTagging(layout.IsTagged());
+   EventContext *context = EventContext::Get();
+   CLHEP::HepRandomEngine *rng = context->GetEngine();
+
+   // Blocks of cascades, per cascade
+   CascadeBlock block;
+   Measure("CascadeBlock::Fill", "cascade", 100L * kCascadeBlockSize, [&] {
+      for (int i = 0; i < 100; i++) block.Fill(ls);
+   });
+   if (strata)
+     Measure("CascadeBlock::Fill stratified", "cascade",
+             100L * kCascadeBlockSize, [&] {
+        for (int i = 0; i < 100; i++) block.Fill(stratified);
+     });
+
+   // Primaries for a dummy event
+   PrimaryGenerator generator(&ls, &random);
+   Measure("PrimaryGenerator::GeneratePrimaries", "event", nevents, [&] {
+      for (long i = 0; i < nevents; i++) {
+         G4Event event(i);
+         generator.GeneratePrimaries(&event);
+      }
+   });
+
+   // Sensitive detector with fabricated steps, without and with the time
+   // pickoff
+   std::vector <G4Step *> steps;
+   for (int i = 0; i < 64; i++) steps.push_back(MakeStep(rng));
+   TimePickoff pickoff;
+   if (pickoff_options && !pickoff.Configure(pickoff_options)) exit(-1);
+   for (int p = 0; p < 2; p++) {
+      SensitiveDetector sd(p ? "bench_pickoff" : "bench");
+      sd.SetID(0);
+      sd.SetContext(context);
+      if (p) sd.SetPickoff(&pickoff);
+      Datum &data = context->GetDatum();
+      unsigned int k = 0;
+      Measure(p ? "SD::ProcessHits pickoff" : "SD::ProcessHits", "hit",
+              nevents * nhits, [&] {
+         for (long i = 0; i < nevents; i++) {
+            sd.Initialize(NULL);
+            for (int j = 0; j < nhits; j++)
+              sd.ProcessHits(steps[k++ & 63], NULL);
+         }
+      });
+      Measure(p ? "SD event pickoff" : "SD event", "event", nevents, [&] {
+         for (long i = 0; i < nevents; i++) {
+            sd.Initialize(NULL);
+            for (int j = 0; j < nhits; j++)
+              sd.ProcessHits(steps[k++ & 63], NULL);
+            sd.EndOfEvent(NULL);
+            data.Reset();
+         }
+      });
+   }
+   for (unsigned int i = 0; i < steps.size(); i++) {
+      delete steps[i]->GetTrack();
+      delete steps[i];
+   }
+
+   // Datum copy, reset and setting values
+   Datum a(ndet, nperdet), b(ndet, nperdet);
+   for (unsigned int i = 0; i < ndet; i++)
+     for (unsigned int j = 0; j < nperdet; j++) a.SetValue(i, j, i + j);
+   Measure("Datum copy", "event", nevents, [&] {
+      for (long i = 0; i < nevents; i++) b = a;
+   });
+   Measure("Datum reset", "event", nevents, [&] {
+      for (long i = 0; i < nevents; i++) b.Reset();
+   });
+   Measure("Datum SetValue", "value", nevents * nperdet, [&] {
+      for (long i = 0; i < nevents; i++)
+        for (unsigned int j = 0; j < nperdet; j++) b.SetValue(i % ndet, j, i);
+   });
+   Measure("Datum Store", "detector", nevents, [&] {
+      for (long i = 0; i < nevents; i++)
+        b.Store(i % ndet, i, i, i, i, i);
+   });
+
+   // Packing into the record of a block and unpacking it again
+   std::vector <char> packed(layout.GetSize());
+   Measure("Record pack", "event", nevents, [&] {
+      for (long i = 0; i < nevents; i++)
+        layout.Pack(a.GetPointer(), packed.data());
+   });
+   Measure("Record unpack", "event", nevents, [&] {
+      for (long i = 0; i < nevents; i++)
+        layout.Unpack(packed.data(), b.GetPointer());
+   });
+   sink = b.GetValue(0, 0);
+
+   // Event action into the output, with 1, 2, 4 ... threads at once. The
+   // time is the wall time per event over all the threads.
+   RootOutput output;
+   if (root_options && !output.Configure(root_options)) exit(-1);
+   if (!output.Open(filename, &layout, nthreads)) exit(-1);
+   for (int n = 1; ; n *= 2) {
+      if (n > nthreads) n = nthreads;
+      char what[64];
+      snprintf(what, sizeof(what), "EventAction fill %d thread%s", n,
+               n > 1 ? "s" : "");
+      Measure(what, "event", nevents * n, [&] {
+         std::vector <std::thread> threads;
+         for (int i = 0; i < n; i++)
+           threads.push_back(std::thread(Fill, &output, ndet, nevents));
+         for (int i = 0; i < n; i++) threads[i].join();
+      });
+      if (n == nthreads) break;
+   }
+   if (!output.Write()) exit(-1);
+   output.Close();
+}
@@ -0,0 +1,129 @@
+// Micro-benchmark of the random number engines. For each engine, we measure
+// the cost of a flat random number and of PrimaryGenerator::GeneratePrimaries
+// into a dummy event, both with blocks of pre-generated cascades and with
+// per-event streams (i.e. reseeding for every event). Each engine runs in its
+// own thread, so that it gets its own engine and event context, just like a
+// worker. Each measurement is repeated and we give the mean and the standard
+// deviation in ns per operation.
+
+#include <G4Event.hh>
+#include <Randomize.hh>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <unistd.h>
+
+#include "EventContext.hh"
+#include "PrimaryGenerator.hh"
+#include "RandomSetup.hh"
+
+static const int nrepeat = 5; // Number of repetitions of each measurement
+
+//-----------------------------------------------------------------------------
+// Get the time in ns
+double Now() {
+   return(std::chrono::duration <double, std::nano>
+          (std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+//-----------------------------------------------------------------------------
+// Print the mean and standard deviation of the measurements
+void Report(const char *engine, const char *what, std::vector <double> &t) {
+   double sum = 0, sum2 = 0;
+   for (unsigned int i = 0; i < t.size(); i++) {
+      sum += t[i];
+      sum2 += t[i] * t[i];
+   }
+   double mean = sum / t.size();
+   double sigma = sqrt(fabs(sum2 / t.size() - mean * mean));
+   printf("%-12s %-24s %10.2f +- %7.2f ns\n", engine, what, mean, sigma);
+}
+
+//-----------------------------------------------------------------------------
+// Run the benchmarks for one engine. This runs in its own thread.
+void Benchmark(const char *engine, const LevelScheme *ls, long nevents) {
+
+   std::vector <double> t;
+
+   // Set up the engine for this thread
+   RandomSetup random;
+   random.SetEngine(engine);
+   random.SetSeed(12345);
+   G4Random::setTheEngine(random.Create());
+   G4Random::setTheSeed(12345);
+   CLHEP::HepRandomEngine *rng = EventContext::Get()->GetEngine();
+
+   // Flat random numbers
+   long nflat = nevents * 10;
+   double sum = 0;
+   for (int r = 0; r < nrepeat; r++) {
+      double t0 = Now();
+      for (long i = 0; i < nflat; i++) sum += rng->flat();
+      t.push_back((Now() - t0) / nflat);
+   }
+   Report(engine, "flat()", t);
+
+   // GeneratePrimaries with blocks and then with per-event streams
+   for (int streams = 0; streams < 2; streams++) {
+      random.SetStreams(streams);
+      PrimaryGenerator generator(ls, &random);
+      t.clear();
+      for (int r = 0; r < nrepeat; r++) {
+         double t0 = Now();
+         for (long i = 0; i < nevents; i++) {
+            G4Event event(i);
+            generator.GeneratePrimaries(&event);
+         }
+         t.push_back((Now() - t0) / nevents);
+      }
+      Report(engine, streams ? "GeneratePrimaries stream" :
+             "GeneratePrimaries block", t);
+   }
+
+   // Make sure the compiler doesn't optimise the flat numbers away
+   if (sum < 0) printf("%f\n", sum);
+}
+
+//-----------------------------------------------------------------------------
+int main(int argc, char **argv) {
+
+   int c;
+   long nevents = 1000000;
+   const char *levelscheme = "levelscheme.dat";
+   const char *engines[] = {"ranlux:3", "ranlux:4", "ranlux64:1", "mixmax",
+                            "ranecu", "mtwist", "philox"};
+   extern char *optarg;
+
+   // Handle arguments
+   while(1) {
+      c = getopt(argc, argv, "l:n:");
+      if (c == -1) break;
+
+      switch(c) {
+       case 'l': // Level scheme
+         levelscheme = optarg;
+         break;
+       case 'n': // Number of events per measurement
+         nevents = atol(optarg);
+         break;
+       default:
+         fprintf(stderr, "Usage: %s [-l levelscheme] [-n number_of_events]\n", argv[0]);
+         exit(-1);
+         break;
+      }
+   }
+
+   // Read the level scheme, which the threads share
+   LevelScheme ls;
+   if (!ls.Read(levelscheme)) exit(-1);
+
+   // Each engine in its own thread, one after the other
+   for (unsigned int i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+      std::thread thread(Benchmark, engines[i], &ls, nevents);
+      thread.join();
+   }
+}
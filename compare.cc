@@ -0,0 +1,251 @@
+// Physics regression test: compare the output of LaBr_timing with a stored
+// reference. We compare the energy spectrum of each detector, the
+// distribution of the number of detectors which fired per event and the
+// time-difference spectrum of each pair of detectors for each gate (see
+// TimingAnalysis.hh) with a chi-square test and a Kolmogorov-Smirnov test.
+// A comparison fails if either probability is below the significance level
+// divided by the number of comparisons (Bonferroni), so the chance of a false
+// alarm for the whole file is about the significance level. We also show the
+// throughput of both simulations (events_per_s in the files), so a change
+// which is meant to make the simulation faster is checked for both speed and
+// physics. The exit status is non-zero if any comparison fails.
+//
+// Either file can have weighted events (stratified sampling), in which case
+// its histograms are weighted and the chi-square test treats them as such.
+// The events of a file made with splitting (-B) are branches of the same
+// decays and aren't independent, so the chi-square test is too strict for
+// it and we warn about it.
+// The files can have different record layouts (see RecordLayout.hh), e.g. a
+// float reference and a double test, and each gives its own number of values
+// per detector unless it is given with -p.
+
+#include <TFile.h>
+#include <TTree.h>
+#include <TLeaf.h>
+#include <TH1.h>
+#include <TH1D.h>
+#include <TParameter.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+
+#include "TimingAnalysis.hh"
+
+//-----------------------------------------------------------------------------
+// Everything we compare for one file
+struct Result {
+   TFile *file;                    // The root file
+   std::vector <TH1 *> spectra;    // Energy spectrum of each detector
+   TH1D *multiplicity;             // Number of detectors fired per event
+   TimingAnalysis *analysis;       // Time-difference spectra
+   double throughput;              // Events per second (0 if unknown)
+   bool weighted;                  // Are the events weighted?
+   double splitting;               // Splitting factor (0 if none)
+};
+
+//-----------------------------------------------------------------------------
+// Read a file. Returns false if we can't.
+bool Read(const char *filename, unsigned int nperdet, const char *gatefile,
+          double range, double binwidth, Result &r) {
+
+   // Open the file and get the tree
+   r.file = TFile::Open(filename);
+   if (!r.file || r.file->IsZombie()) {
+      fprintf(stderr, "Unable to open %s\n", filename);
+      return(false);
+   }
+   TTree *tree = (TTree *)r.file->Get("g4");
+   if (!tree || !tree->GetLeaf("values")) {
+      fprintf(stderr, "No g4 tree with values in %s\n", filename);
+      return(false);
+   }
+   unsigned int nvalues = tree->GetLeaf("values")->GetLenStatic();
+   TParameter <double> *np =
+     (TParameter <double> *)r.file->Get("values_per_detector");
+   if (nperdet == 0) nperdet = np ? (unsigned int)np->GetVal() : 5;
+   unsigned int ndet = nvalues / nperdet;
+   std::vector <double> values(nvalues);
+   std::vector <Float_t> fvalues;
+   double weight = 1;
+   bool single = !strcmp(tree->GetLeaf("values")->GetTypeName(), "Float_t");
+   if (single) {
+      fvalues.resize(nvalues);
+      tree->SetBranchAddress("values", fvalues.data());
+   } else
+     tree->SetBranchAddress("values", values.data());
+   r.weighted = (tree->GetBranch("weight") != NULL);
+   if (r.weighted) tree->SetBranchAddress("weight", &weight);
+
+   // Energy spectra
+   for (unsigned int i = 0; i < ndet; i++) {
+      TH1 *h = (TH1 *)r.file->Get(Form("LaBr3_%u", i));
+      if (!h) {
+         fprintf(stderr, "No spectrum LaBr3_%u in %s\n", i, filename);
+         return(false);
+      }
+      r.spectra.push_back(h);
+   }
+
+   // Throughput
+   TParameter <double> *p =
+     (TParameter <double> *)r.file->Get("events_per_s");
+   r.throughput = p ? p->GetVal() : 0;
+
+   // Splitting factor
+   TParameter <double> *s =
+     (TParameter <double> *)r.file->Get("splitting");
+   r.splitting = s ? s->GetVal() : 0;
+   if (r.splitting > 0)
+     fprintf(stderr, "Warning: %s was split %g times, its events are "
+             "correlated and the chi-square test is too strict\n", filename,
+             r.splitting);
+
+   // Multiplicity and time differences from the tree
+   r.multiplicity = new TH1D(Form("multiplicity_%p", (void *)&r),
+                             "Multiplicity", ndet + 1, -0.5, ndet + 0.5);
+   r.analysis = new TimingAnalysis(ndet, nperdet, range, binwidth);
+   if (!r.analysis->Read(gatefile)) return(false);
+   Long64_t nentries = tree->GetEntries();
+   for (Long64_t entry = 0; entry < nentries; entry++) {
+      tree->GetEntry(entry);
+      if (single)
+        for (unsigned int j = 0; j < nvalues; j++) values[j] = fvalues[j];
+      unsigned int n = 0;
+      for (unsigned int i = 0; i < ndet; i++)
+        if (values[i * nperdet] > 0) n++;
+      r.multiplicity->Fill(n, weight);
+      r.analysis->Process(values.data(), weight);
+   }
+   printf("%s: %lld %sevents, %u detectors\n", filename, nentries,
+          r.weighted ? "weighted " : "", ndet);
+   return(true);
+}
+
+//-----------------------------------------------------------------------------
+// A pair of histograms to compare
+struct Comparison {
+   TString name;      // What we are comparing
+   TH1 *ref, *test;   // Reference and test histograms
+};
+
+//-----------------------------------------------------------------------------
+int main(int argc, char **argv) {
+
+   int c, nperdet = 0;
+   double alpha = 0.01, range = 10000, binwidth = 5;
+   const char *gatefile = "gates.dat";
+   extern char *optarg;
+   extern int optind;
+
+   // Handle arguments
+   while(1) {
+      c = getopt(argc, argv, "a:b:g:p:r:");
+      if (c == -1) break;
+
+      switch(c) {
+       case 'a': // Significance level
+         alpha = atof(optarg);
+         break;
+       case 'b': // Bin width in ps
+         binwidth = atof(optarg);
+         break;
+       case 'g': // Gate file
+         gatefile = optarg;
+         break;
+       case 'p': // Number of values per detector
+         nperdet = atoi(optarg);
+         break;
+       case 'r': // Time range in ps
+         range = atof(optarg);
+         break;
+       default:
+         optind = argc;
+         break;
+      }
+   }
+   if (argc - optind != 2) {
+      fprintf(stderr, "Usage: %s [-a significance] [-b binwidth_ps] [-g gatefile] [-p values_per_detector] [-r range_ps] reference_rootfile test_rootfile\n", argv[0]);
+      exit(-1);
+   }
+   const char *reffile = argv[optind], *testfile = argv[optind + 1];
+
+   // Read both files
+   TH1::AddDirectory(false);
+   Result ref, test;
+   if (!Read(reffile, nperdet, gatefile, range, binwidth, ref)) exit(-1);
+   if (!Read(testfile, nperdet, gatefile, range, binwidth, test)) exit(-1);
+   if (ref.spectra.size() != test.spectra.size()) {
+      fprintf(stderr, "Different numbers of detectors\n");
+      exit(1);
+   }
+
+   // Make the list of comparisons
+   std::vector <Comparison> comparisons;
+   unsigned int ndet = ref.spectra.size();
+   for (unsigned int i = 0; i < ndet; i++) {
+      Comparison cmp = {Form("LaBr3_%u energy", i), ref.spectra[i],
+                        test.spectra[i]};
+      comparisons.push_back(cmp);
+   }
+   Comparison mult = {"multiplicity", ref.multiplicity, test.multiplicity};
+   comparisons.push_back(mult);
+   for (unsigned int g = 0; g < ref.analysis->GetNGates(); g++) {
+      for (unsigned int i = 0; i < ndet; i++) {
+         for (unsigned int j = 0; j < ndet; j++) {
+            TH1 *hr = ref.analysis->GetSpectrum(g, i, j);
+            TH1 *ht = test.analysis->GetSpectrum(g, i, j);
+            if (!hr || !ht) continue;
+            if (hr->GetEntries() == 0 && ht->GetEntries() == 0) continue;
+            Comparison cmp = {Form("gate %u dT %u-%u", g, i, j), hr, ht};
+            comparisons.push_back(cmp);
+         }
+      }
+   }
+
+   // Compare them
+   double threshold = alpha / comparisons.size();
+   unsigned int nfail = 0;
+   printf("%-24s %12s %12s %10s %10s\n", "Comparison", "Reference", "Test",
+          "P(chi2)", "P(KS)");
+   for (unsigned int i = 0; i < comparisons.size(); i++) {
+      Comparison &cmp = comparisons[i];
+      double pchi2 = 0, pks = 0;
+      if (cmp.ref->GetEntries() > 0 && cmp.test->GetEntries() > 0) {
+         // The chi-square test knows unweighted against weighted (UW), but
+         // not the other way round, so we swap them for that
+         if (ref.weighted && !test.weighted)
+           pchi2 = cmp.test->Chi2Test(cmp.ref, "UW");
+         else
+           pchi2 = cmp.ref->Chi2Test(cmp.test, ref.weighted ? "WW" :
+                                     test.weighted ? "UW" : "UU");
+         pks = cmp.ref->KolmogorovTest(cmp.test);
+      }
+      bool pass = (pchi2 >= threshold && pks >= threshold);
+      if (!pass) nfail++;
+      printf("%-24s %12.0f %12.0f %10.3g %10.3g %s\n", cmp.name.Data(),
+             cmp.ref->GetEntries(), cmp.test->GetEntries(), pchi2, pks,
+             pass ? "pass" : "FAIL");
+   }
+
+   // Summary with the throughput
+   printf("Throughput: reference %.1f events/s test %.1f events/s",
+          ref.throughput, test.throughput);
+   if (ref.throughput > 0 && test.throughput > 0)
+     printf(" (x %.3f)", test.throughput / ref.throughput);
+   printf("\n");
+   printf("%s: %u of %lu comparisons failed (significance %g)\n",
+          nfail ? "FAIL" : "PASS", nfail, (unsigned long)comparisons.size(),
+          alpha);
+
+   // Clean up
+   delete ref.analysis;
+   delete test.analysis;
+   delete ref.multiplicity;
+   delete test.multiplicity;
+   ref.file->Close();
+   test.file->Close();
+   return(nfail ? 1 : 0);
+}
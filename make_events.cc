@@ -0,0 +1,118 @@
+// Write a file of primary events for LaBr_timing -i (see EventInput.hh) with
+// the cascades of a level scheme, generated by the same blocks of cascades
+// as the simulation (see CascadeBlock.hh). A run from the file should then
+// agree with a run from the level scheme, which is the regression test of
+// the input (make regress), and the code shows another code how to write
+// the format. Each event is a cascade of gammas, with the time of each
+// relative to the first.
+
+#include <G4SystemOfUnits.hh>
+#include <Randomize.hh>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+#include <unistd.h>
+
+#include "CascadeBlock.hh"
+#include "EventContext.hh"
+#include "LevelScheme.hh"
+#include "RandomSetup.hh"
+
+//-----------------------------------------------------------------------------
+int main(int argc, char **argv) {
+
+   int c;
+   long nevents = 1000000, seed = 12345;
+   const char *levelscheme = "levelscheme.dat";
+   const char *filename = "events.lbev";
+   const char *engine = "mixmax";
+   extern char *optarg;
+
+   // Handle arguments
+   while(1) {
+      c = getopt(argc, argv, "e:l:n:o:s:");
+      if (c == -1) break;
+
+      switch(c) {
+       case 'e': // Random number engine
+         engine = optarg;
+         break;
+       case 'l': // Level scheme
+         levelscheme = optarg;
+         break;
+       case 'n': // Number of events to write
+         nevents = atol(optarg);
+         break;
+       case 'o': // Event file
+         filename = optarg;
+         break;
+       case 's': // Seed
+         seed = atol(optarg);
+         break;
+       default:
+         fprintf(stderr, "Usage: %s [-e engine[:luxury]] [-l levelscheme] [-n number_of_events] [-o event_file] [-s seed]\n", argv[0]);
+         exit(-1);
+         break;
+      }
+   }
+
+   // Read the level scheme
+   LevelScheme ls;
+   if (!ls.Read(levelscheme)) exit(-1);
+
+   // Set up the engine of this thread and the event context, whose engine
+   // the blocks of cascades use
+   RandomSetup random;
+   if (!random.SetEngine(engine)) exit(-1);
+   random.SetSeed(seed);
+   G4Random::setTheEngine(random.Create());
+   G4Random::setTheSeed(seed);
+   EventContext::SetDimensions(1, 2);
+   EventContext::Get();
+
+   // Open the file and write the header
+   FILE *fp = fopen(filename, "wb");
+   if (!fp) {
+      fprintf(stderr, "Unable to write file %s\n", filename);
+      exit(-1);
+   }
+   uint32_t version = 1;
+   fwrite("LBEV", 4, 1, fp);
+   fwrite(&version, sizeof(version), 1, fp);
+
+   // Write each cascade as an event, packing its vertices as EventInput
+   // reads them
+   CascadeBlock block;
+   std::vector <char> raw;
+   for (long k = 0; k < nevents; k++) {
+      if (block.IsEmpty()) block.Fill(ls);
+      unsigned int index;
+      uint32_t n = block.Pop(index);
+      raw.resize(28 * (size_t)n);
+      for (uint32_t i = 0; i < n; i++) {
+         char *v = raw.data() + 28 * (size_t)i;
+         double time = block.GetTime(index + i) / ps;
+         G4ThreeVector dir = block.GetDirection(index + i);
+         float f[4] = { (float)(block.GetEnergy(index + i) / keV),
+                        (float)dir.x(), (float)dir.y(), (float)dir.z() };
+         int32_t pdg = 22;
+         memcpy(v, &time, 8);
+         memcpy(v + 8, f, 16);
+         memcpy(v + 24, &pdg, 4);
+      }
+      fwrite(&n, sizeof(n), 1, fp);
+      if (n) fwrite(raw.data(), 28, n, fp);
+   }
+
+   // Close the file, checking that everything was written
+   if (ferror(fp) | fclose(fp)) {
+      fprintf(stderr, "Unable to write file %s\n", filename);
+      exit(-1);
+   }
+   printf("Wrote %ld events from %s to %s\n", nevents, levelscheme,
+          filename);
+   return(0);
+}
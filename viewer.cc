@@ -0,0 +1,125 @@
+// Viewer for the status of a running simulation, which LaBr_timing publishes
+// in shared memory with the -m option (see LiveStatus.hh). It takes a
+// snapshot at regular intervals without disturbing the simulation and shows
+// the event rate, the throughput of each worker thread, the lock statistics
+// of the block pool and the hit rate of each detector. The rates are since
+// the previous snapshot. It can also write the LaBr3 spectra of the last
+// snapshot to a root file.
+
+#include <TFile.h>
+#include <TH1I.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+#include <unistd.h>
+#include <signal.h>
+
+#include "LiveStatus.hh"
+
+//-----------------------------------------------------------------------------
+// Show a snapshot and the rates since the previous one
+void Show(const LiveData *d, const LiveData *prev) {
+   double dt = prev ? d->elapsed - prev->elapsed : d->elapsed;
+   if (dt <= 0) dt = 1e-9;
+   double n = d->nevents - (prev ? prev->nevents : 0);
+   printf("\nPID %u: %.0f s, %llu events, %.1f events/s\n", d->pid,
+          d->elapsed, (unsigned long long)d->nevents, n / dt);
+
+   // Threads
+   for (unsigned int i = 0; i < d->nthreads; i++) {
+      double ni = d->thread_events[i] - (prev ? prev->thread_events[i] : 0);
+      printf("\tthread %3u: %12llu events %10.1f events/s\n", i,
+             (unsigned long long)d->thread_events[i], ni / dt);
+   }
+
+   // Locks
+   printf("\tpool locked %llu times, %llu contended (%.2f%%), %llu waits for a block (%.3f s)\n",
+          (unsigned long long)d->nlocks, (unsigned long long)d->ncontended,
+          d->nlocks ? 100. * d->ncontended / d->nlocks : 0.,
+          (unsigned long long)d->nwaits, d->wait_time);
+
+   // Detectors
+   for (unsigned int j = 0; j < d->ndet; j++) {
+      double nj = d->hits[j] - (prev ? prev->hits[j] : 0);
+      printf("\tLaBr3_%u: %12llu hits %10.1f hits/s\n", j,
+             (unsigned long long)d->hits[j], nj / dt);
+   }
+}
+
+//-----------------------------------------------------------------------------
+// Write the spectra of a snapshot to a root file
+void WriteSpectra(const LiveData *d, const char *filename) {
+   TFile *f = TFile::Open(filename, "recreate");
+   if (!f || f->IsZombie()) {
+      fprintf(stderr, "Unable to open root file %s\n", filename);
+      return;
+   }
+   for (unsigned int j = 0; j < d->ndet; j++) {
+      TH1I *h = new TH1I(Form("LaBr3_%u", j), Form("LaBr3_%u", j),
+                         LIVE_NBINS, 0, LIVE_EMAX);
+      for (unsigned int b = 0; b < LIVE_NBINS; b++)
+        h->SetBinContent(b + 1, d->spectra[j * LIVE_NBINS + b]);
+      h->Write();
+   }
+   f->Close();
+   delete f;
+}
+
+//-----------------------------------------------------------------------------
+int main(int argc, char **argv) {
+
+   int c, nsnapshots = 0;
+   double interval = 5;
+   const char *name = "/LaBr_timing";
+   const char *filename = NULL;
+   extern char *optarg;
+
+   // Handle arguments
+   while(1) {
+      c = getopt(argc, argv, "i:m:n:o:");
+      if (c == -1) break;
+
+      switch(c) {
+       case 'i': // Interval between snapshots in s
+         interval = atof(optarg);
+         break;
+       case 'm': // Shared memory name
+         name = optarg;
+         break;
+       case 'n': // Number of snapshots (0 = until the simulation ends)
+         nsnapshots = atoi(optarg);
+         break;
+       case 'o': // Root file for the spectra
+         filename = optarg;
+         break;
+       default:
+         fprintf(stderr, "Usage: %s [-i interval_s] [-m shared_memory] [-n number_of_snapshots] [-o spectra_rootfile]\n", argv[0]);
+         exit(-1);
+         break;
+      }
+   }
+
+   // Attach to the shared memory
+   LiveStatus live;
+   if (!live.Attach(name)) exit(-1);
+
+   // Take snapshots until we have enough or the simulation has gone
+   LiveData *d = new LiveData;
+   LiveData *prev = new LiveData;
+   bool first = true;
+   for (int i = 0; nsnapshots <= 0 || i < nsnapshots; i++) {
+      if (i) usleep((useconds_t)(interval * 1e6));
+      if (!live.Read(d)) {
+         fprintf(stderr, "Unable to get a consistent snapshot\n");
+         continue;
+      }
+      Show(d, first ? NULL : prev);
+      if (filename) WriteSpectra(d, filename);
+      std::swap(d, prev);
+      first = false;
+      if (kill(prev->pid, 0) && nsnapshots <= 0) break;
+   }
+   delete d;
+   delete prev;
+}